@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * pvms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDebug>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <unistd.h>
+
+#include "cpu_topology.h"
+
+static const QString SYSFS_CPU = QStringLiteral("/sys/devices/system/cpu");
+
+static int readNumber(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+    return file.readAll().trimmed().toInt();
+}
+
+QList<int> CpuTopology::onlineCpus()
+{
+    QList<int> ret;
+
+    // A list of ranges, e.g. "0-3,6"
+    QFile onlineFile(SYSFS_CPU + QStringLiteral("/online"));
+    if (onlineFile.open(QFile::ReadOnly)) {
+        const QStringList ranges = QString::fromLatin1(onlineFile.readAll().trimmed()).split(',', QString::SkipEmptyParts);
+        for (const QString& range : ranges) {
+            const QStringList bounds = range.split('-');
+            const int first = bounds.first().toInt();
+            const int last = bounds.last().toInt();
+            for (int i = first; i <= last; i++)
+                ret << i;
+        }
+    }
+
+    if (ret.isEmpty()) {
+        qWarning() << "Failed to read the online CPUs, assuming all are";
+        const long count = sysconf(_SC_NPROCESSORS_CONF);
+        for (int i = 0; i < count; i++)
+            ret << i;
+    }
+
+    return ret;
+}
+
+QList<HostCpu> CpuTopology::probe()
+{
+    QList<HostCpu> ret;
+
+    for (const int index : onlineCpus()) {
+        const QString cpuPath = QStringLiteral("%1/cpu%2").arg(SYSFS_CPU).arg(index);
+        HostCpu cpu;
+        cpu.index = index;
+        cpu.capacity = readNumber(cpuPath + QStringLiteral("/cpu_capacity"));
+        cpu.maxFrequency = readNumber(cpuPath + QStringLiteral("/cpufreq/cpuinfo_max_freq"));
+        ret << cpu;
+    }
+
+    return ret;
+}
+
+bool CpuTopology::hasCapacities(const QList<HostCpu>& cpus)
+{
+    for (const HostCpu& cpu : cpus) {
+        if (cpu.capacity <= 0)
+            return false;
+    }
+    return !cpus.isEmpty();
+}
+
+int CpuTopology::performanceOf(const HostCpu& cpu, bool useCapacity)
+{
+    return useCapacity ? cpu.capacity : cpu.maxFrequency;
+}
+
+QList<int> CpuTopology::byPerformance()
+{
+    QList<HostCpu> cpus = probe();
+    const bool useCapacity = hasCapacities(cpus);
+
+    // Stable, so that equal CPUs stay in their natural order
+    std::stable_sort(cpus.begin(), cpus.end(), [=](const HostCpu& a, const HostCpu& b) {
+        return performanceOf(a, useCapacity) > performanceOf(b, useCapacity);
+    });
+
+    QList<int> ret;
+    for (const HostCpu& cpu : cpus)
+        ret << cpu.index;
+    return ret;
+}
+
+QList<int> CpuTopology::performanceCores()
+{
+    const QList<HostCpu> cpus = probe();
+    const bool useCapacity = hasCapacities(cpus);
+
+    int best = 0;
+    for (const HostCpu& cpu : cpus)
+        best = std::max(best, performanceOf(cpu, useCapacity));
+
+    QList<int> ret;
+    for (const HostCpu& cpu : cpus) {
+        if (performanceOf(cpu, useCapacity) == best)
+            ret << cpu.index;
+    }
+    return ret;
+}
+
+QList<int> CpuTopology::efficiencyCores()
+{
+    const QList<int> performance = performanceCores();
+
+    QList<int> ret;
+    for (const int index : onlineCpus()) {
+        if (!performance.contains(index))
+            ret << index;
+    }
+    return ret;
+}
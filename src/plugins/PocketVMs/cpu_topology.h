@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * pvms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#include <QList>
+
+// An online host CPU, as described by sysfs
+struct HostCpu {
+    int index = -1;
+    int capacity = 0; // relative to the fastest core, which is 1024; 0 if unknown
+    int maxFrequency = 0; // kHz, 0 if unknown
+};
+
+// The host CPUs, told apart by their performance on big.LITTLE systems.
+// The capacity of arm64 kernels is preferred, the maximum frequency is
+// the fallback for kernels and architectures without one.
+class CpuTopology {
+public:
+    static QList<HostCpu> probe();
+
+    // Fastest first
+    static QList<int> byPerformance();
+    // The CPUs of the fastest kind
+    static QList<int> performanceCores();
+    // All the others; empty if all CPUs are of the same kind
+    static QList<int> efficiencyCores();
+    static QList<int> onlineCpus();
+
+private:
+    static int performanceOf(const HostCpu& cpu, bool useCapacity);
+    static bool hasCapacities(const QList<HostCpu>& cpus);
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dmabuf_texture.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QVector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <atomic>
+#include <unistd.h>
+
+using namespace LomiriVNC;
+
+/* DRM_FORMAT_MOD_INVALID and DRM_FORMAT_MOD_LINEAR */
+static const quint64 modifierInvalid = 0x00ffffffffffffffULL;
+static const quint64 modifierLinear = 0;
+
+/* Set by the render thread, read by the GUI one */
+static std::atomic<bool> importFailed(false);
+
+typedef void (*ImageTargetTexture2DProc)(GLenum target, void *image);
+/* EGL_MESA_image_dma_buf_export */
+typedef EGLBoolean (*ExportQueryProc)(EGLDisplay display, EGLImageKHR image,
+                                      int *fourcc, int *planes,
+                                      quint64 *modifiers);
+typedef EGLBoolean (*ExportProc)(EGLDisplay display, EGLImageKHR image,
+                                 int *fds, EGLint *strides, EGLint *offsets);
+
+static bool hasExtension(const char *extensions, const char *name)
+{
+    return extensions && QByteArray(extensions).split(' ').contains(name);
+}
+
+static PFNEGLCREATEIMAGEKHRPROC createImage()
+{
+    static const PFNEGLCREATEIMAGEKHRPROC function =
+        reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+            eglGetProcAddress("eglCreateImageKHR"));
+    return function;
+}
+
+static PFNEGLDESTROYIMAGEKHRPROC destroyImage()
+{
+    static const PFNEGLDESTROYIMAGEKHRPROC function =
+        reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+            eglGetProcAddress("eglDestroyImageKHR"));
+    return function;
+}
+
+static ImageTargetTexture2DProc imageTargetTexture2D()
+{
+    static const ImageTargetTexture2DProc function =
+        reinterpret_cast<ImageTargetTexture2DProc>(
+            eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+    return function;
+}
+
+DmabufBuffer::~DmabufBuffer()
+{
+    if (fd >= 0) ::close(fd);
+}
+
+DmabufTexture::DmabufTexture():
+    QSGTexture(),
+    m_image(nullptr),
+    m_textureId(0),
+    m_bindOptionsDirty(true)
+{
+}
+
+DmabufTexture::~DmabufTexture()
+{
+    releaseImage();
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (m_textureId && context) {
+        context->functions()->glDeleteTextures(1, &m_textureId);
+    }
+}
+
+/* Exports a texture the way QEMU exports the scanouts of virglrenderer
+ * (see ui/egl-helpers.c), so that importing it tells whether the buffers
+ * QEMU will send can be sampled, modifiers included. Returns false if the
+ * driver cannot export buffers at all. */
+static bool exportTestBuffer(QOpenGLContext *context, EGLDisplay display,
+                             DmabufBuffer *buffer)
+{
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    const ExportQueryProc exportQuery = reinterpret_cast<ExportQueryProc>(
+        eglGetProcAddress("eglExportDMABUFImageQueryMESA"));
+    const ExportProc exportImage = reinterpret_cast<ExportProc>(
+        eglGetProcAddress("eglExportDMABUFImageMESA"));
+    if (!hasExtension(extensions, "EGL_MESA_image_dma_buf_export") ||
+        !hasExtension(extensions, "EGL_KHR_gl_texture_2D_image") ||
+        !exportQuery || !exportImage) {
+        return false;
+    }
+
+    const QSize size(64, 64);
+    QOpenGLFunctions *f = context->functions();
+    GLuint textureId = 0;
+    f->glGenTextures(1, &textureId);
+    f->glBindTexture(GL_TEXTURE_2D, textureId);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    f->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width(), size.height(),
+                    0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    bool ok = false;
+    EGLImageKHR image = createImage()(
+        display, eglGetCurrentContext(), EGL_GL_TEXTURE_2D_KHR,
+        reinterpret_cast<EGLClientBuffer>(quintptr(textureId)), nullptr);
+    if (image != EGL_NO_IMAGE_KHR) {
+        int fourcc = 0, planes = 0;
+        quint64 modifier = modifierInvalid;
+        EGLint stride = 0, offset = 0;
+        if (exportQuery(display, image, &fourcc, &planes, &modifier) &&
+            planes == 1 &&
+            exportImage(display, image, &buffer->fd, &stride, &offset)) {
+            buffer->size = size;
+            buffer->stride = stride;
+            buffer->fourcc = fourcc;
+            buffer->modifier = modifier;
+            /* Like QEMU, setBuffer() assumes the plane starts the buffer */
+            ok = offset == 0;
+        }
+        destroyImage()(display, image);
+    }
+    f->glDeleteTextures(1, &textureId);
+    return ok;
+}
+
+/* Qt creates its contexts on the EGL display of the platform, the same one
+ * the scene graph renders with, so the probe runs in a context of our own
+ * rather than on EGL_DEFAULT_DISPLAY, which can be a different one. */
+static bool probeImport()
+{
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    if (!context.create()) return false;
+
+    QOpenGLContext *previous = QOpenGLContext::currentContext();
+    QSurface *previousSurface = previous ? previous->surface() : nullptr;
+
+    bool ok = false;
+    if (context.makeCurrent(&surface)) {
+        EGLDisplay display = eglGetCurrentDisplay();
+        if (display != EGL_NO_DISPLAY &&
+            hasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                         "EGL_EXT_image_dma_buf_import") &&
+            createImage() && destroyImage() && imageTargetTexture2D()) {
+            QSharedPointer<DmabufBuffer> buffer(new DmabufBuffer);
+            if (exportTestBuffer(&context, display, buffer.data())) {
+                DmabufTexture texture;
+                ok = texture.setBuffer(buffer);
+            } else {
+                /* Nothing to try it with, the extension has to do */
+                ok = true;
+            }
+        }
+        context.doneCurrent();
+    }
+
+    if (previous) previous->makeCurrent(previousSurface);
+    return ok;
+}
+
+bool DmabufTexture::isSupported()
+{
+    static const bool supported = probeImport();
+    return supported && !importFailed;
+}
+
+void DmabufTexture::releaseImage()
+{
+    if (!m_image) return;
+    EGLDisplay display = eglGetCurrentDisplay();
+    if (display != EGL_NO_DISPLAY && destroyImage()) {
+        destroyImage()(display, static_cast<EGLImageKHR>(m_image));
+    }
+    m_image = nullptr;
+}
+
+bool DmabufTexture::setBuffer(const QSharedPointer<const DmabufBuffer> &buffer)
+{
+    if (buffer == m_buffer) return m_image != nullptr;
+
+    releaseImage();
+    m_buffer = buffer;
+    if (!buffer) return false;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    EGLDisplay display = eglGetCurrentDisplay();
+    if (Q_UNLIKELY(!context || display == EGL_NO_DISPLAY ||
+                   !createImage() || !imageTargetTexture2D())) {
+        qWarning() << "No EGL context, cannot import the dmabuf";
+        return false;
+    }
+
+    QVector<EGLint> attributes {
+        EGL_WIDTH, buffer->size.width(),
+        EGL_HEIGHT, buffer->size.height(),
+        EGL_LINUX_DRM_FOURCC_EXT, EGLint(buffer->fourcc),
+        EGL_DMA_BUF_PLANE0_FD_EXT, buffer->fd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, buffer->stride,
+    };
+    /* Without the modifiers extension, only linear buffers can be imported,
+     * and the modifier must not be given */
+    if (buffer->modifier != modifierInvalid &&
+        buffer->modifier != modifierLinear) {
+        if (!hasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                          "EGL_EXT_image_dma_buf_import_modifiers")) {
+            qWarning() << "Cannot import a dmabuf with modifier" <<
+                QString::number(buffer->modifier, 16) <<
+                "without EGL_EXT_image_dma_buf_import_modifiers";
+            importFailed = true;
+            return false;
+        }
+        attributes << EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT <<
+            EGLint(buffer->modifier & 0xffffffff) <<
+            EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT <<
+            EGLint(buffer->modifier >> 32);
+    }
+    attributes << EGL_NONE;
+
+    EGLImageKHR image = createImage()(display, EGL_NO_CONTEXT,
+                                      EGL_LINUX_DMA_BUF_EXT, nullptr,
+                                      attributes.constData());
+    if (image == EGL_NO_IMAGE_KHR) {
+        qWarning() << "Could not import the dmabuf, EGL error" <<
+            QString::number(eglGetError(), 16);
+        importFailed = true;
+        return false;
+    }
+    m_image = image;
+
+    QOpenGLFunctions *f = context->functions();
+    if (!m_textureId) {
+        f->glGenTextures(1, &m_textureId);
+    }
+    f->glBindTexture(GL_TEXTURE_2D, m_textureId);
+    imageTargetTexture2D()(GL_TEXTURE_2D, m_image);
+    m_bindOptionsDirty = true;
+    return true;
+}
+
+int DmabufTexture::textureId() const
+{
+    return m_textureId;
+}
+
+QSize DmabufTexture::textureSize() const
+{
+    return m_buffer ? m_buffer->size : QSize();
+}
+
+bool DmabufTexture::hasAlphaChannel() const
+{
+    return false;
+}
+
+bool DmabufTexture::hasMipmaps() const
+{
+    return false;
+}
+
+void DmabufTexture::bind()
+{
+    QOpenGLContext::currentContext()->functions()->
+        glBindTexture(GL_TEXTURE_2D, m_textureId);
+    updateBindOptions(m_bindOptionsDirty);
+    m_bindOptionsDirty = false;
+}
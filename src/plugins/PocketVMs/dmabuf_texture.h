@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_DMABUF_TEXTURE_H
+#define LOMIRIVNC_DMABUF_TEXTURE_H
+
+#include <QSGTexture>
+#include <QSharedPointer>
+#include <QSize>
+
+namespace LomiriVNC {
+
+/* A single-plane buffer exported by the GPU; the file descriptor is closed
+ * with the last reference to it */
+struct DmabufBuffer {
+    DmabufBuffer(): fd(-1), stride(0), fourcc(0), modifier(0), y0Top(true) {}
+    ~DmabufBuffer();
+
+    int fd;
+    QSize size;
+    int stride;
+    quint32 fourcc; // DRM format
+    quint64 modifier;
+    bool y0Top; // false if the rows are stored bottom-up
+};
+
+/* An OpenGL texture sourcing its contents from a dmabuf, through an
+ * EGLImage: the GPU renders into the buffer and the scene graph samples it
+ * directly, without any copy on the CPU.
+ *
+ * setBuffer() must be called from the scene graph synchronization phase,
+ * like VncTexture::upload().
+ */
+class DmabufTexture: public QSGTexture
+{
+    Q_OBJECT
+
+public:
+    DmabufTexture();
+    ~DmabufTexture();
+
+    /* Whether the buffers QEMU exports can be imported; when they can't,
+     * QEMU must be configured to go through VNC instead. The first call
+     * tries an actual import, so it must be made from the GUI thread. Turns
+     * false once an import has failed, so that the machines started
+     * afterwards don't export dmabufs. */
+    static bool isSupported();
+
+    /* Returns false if the buffer could not be imported; buffers with a
+     * tiling modifier need EGL_EXT_image_dma_buf_import_modifiers */
+    bool setBuffer(const QSharedPointer<const DmabufBuffer> &buffer);
+
+    int textureId() const override;
+    QSize textureSize() const override;
+    bool hasAlphaChannel() const override;
+    bool hasMipmaps() const override;
+    void bind() override;
+
+private:
+    void releaseImage();
+
+private:
+    QSharedPointer<const DmabufBuffer> m_buffer;
+    void *m_image; // EGLImageKHR
+    uint m_textureId;
+    bool m_bindOptionsDirty;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_DMABUF_TEXTURE_H
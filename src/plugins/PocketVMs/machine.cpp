@@ -19,21 +19,91 @@
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QProcessEnvironment>
 #include <QSysInfo>
 #include <QTimer>
 #include <QThread>
 
+#include <cerrno>
 #include <csignal>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
 
 #include "machine.h"
+#include "cpu_topology.h"
+#include "dmabuf_texture.h"
+#include "qmp_client.h"
+
+// How long saving the state may take before giving up and killing the VM
+static const int SUSPEND_TIMEOUT_MS = 60000;
+// Don't pause the VMs which are only hidden for a moment
+static const int AUTO_PAUSE_DELAY_MS = 3000;
+// The auto-balloon samples the host memory pressure at this interval, ...
+static const int BALLOON_INTERVAL_MS = 2000;
+// ... shrinks the guest above this share of stalled time (PSI "some avg10") ...
+static const double BALLOON_SHRINK_PRESSURE = 10.0;
+// ... and grows it back after being below this one for a while
+static const double BALLOON_GROW_PRESSURE = 1.0;
+static const int BALLOON_GROW_TICKS = 15;
 
 Machine::Machine()
 {
     this->m_session = new KSession(this);
     QObject::connect(this->m_session, &KSession::started, this, &Machine::started);
+    QObject::connect(this->m_session, &KSession::finished, this, &Machine::onQemuFinished);
     QObject::connect(this->m_session, &KSession::finished, this, &Machine::stopped);
 
+    this->m_qmp = new QmpClient(this);
+    QObject::connect(this->m_qmp, &QmpClient::ready, this, &Machine::pollResume);
+    QObject::connect(this->m_qmp, &QmpClient::ready, this, &Machine::refreshStatus);
+    QObject::connect(this->m_qmp, &QmpClient::ready, this, &Machine::controlReadyChanged);
+    QObject::connect(this->m_qmp, &QmpClient::disconnected, this, &Machine::controlReadyChanged);
+    QObject::connect(this->m_qmp, &QmpClient::event, this, &Machine::onQmpEvent);
+
+    this->m_stopTimer = new QTimer(this);
+    this->m_stopTimer->setSingleShot(true);
+    QObject::connect(this->m_stopTimer, &QTimer::timeout, this, [=](){
+        if (this->m_suspending) {
+            qWarning() << "Timed out saving the state of" << this->name;
+            finishSuspend(false);
+        } else {
+            qWarning() << this->name << "didn't power off in time, killing it";
+            killQemu();
+        }
+    });
+
+    this->m_autoPauseTimer = new QTimer(this);
+    this->m_autoPauseTimer->setSingleShot(true);
+    this->m_autoPauseTimer->setInterval(AUTO_PAUSE_DELAY_MS);
+    QObject::connect(this->m_autoPauseTimer, &QTimer::timeout, this, &Machine::startAutoPause);
+    QObject::connect(this, &Machine::pausePolicyChanged, this, &Machine::updateAutoPause);
+    QObject::connect(this, &Machine::shownChanged, this, &Machine::updateAutoPause);
+    QObject::connect(this, &Machine::controlReadyChanged, this, &Machine::updateAutoPause);
+    QObject::connect(this, &Machine::statusChanged, this, &Machine::updateAutoPause);
+    QObject::connect(qGuiApp, &QGuiApplication::applicationStateChanged, this, &Machine::updateAutoPause);
+
+    this->m_balloonTimer = new QTimer(this);
+    this->m_balloonTimer->setInterval(BALLOON_INTERVAL_MS);
+    QObject::connect(this->m_balloonTimer, &QTimer::timeout, this, &Machine::adjustBalloon);
+    QObject::connect(this, &Machine::autoBalloonChanged, this, &Machine::updateBalloonTimer);
+    QObject::connect(this, &Machine::controlReadyChanged, this, &Machine::updateBalloonTimer);
+    QObject::connect(this->m_qmp, &QmpClient::ready, this, &Machine::applyCpuPlacement);
+    QObject::connect(this, &Machine::cpuPlacementChanged, this, &Machine::applyCpuPlacement);
+    QObject::connect(this->m_qmp, &QmpClient::ready, this, [=](){
+        this->m_qmp->execute(QStringLiteral("query-balloon"), QJsonObject(), [=](const QJsonObject& reply) {
+            if (reply.contains(QStringLiteral("error")))
+                return;
+            const qint64 actual = reply.value(QStringLiteral("return")).toObject()
+                    .value(QStringLiteral("actual")).toVariant().toLongLong();
+            this->m_balloonActual = actual / (1024 * 1024);
+            this->m_balloonTarget = this->m_balloonActual;
+            emit balloonChanged();
+        });
+    });
+
     this->m_fileSharingProcess = new QProcess(this);
     QObject::connect(this->m_fileSharingProcess, &QProcess::stateChanged, this, [=](QProcess::ProcessState newState) {
         qDebug() << "virtiofsd new state:" << newState;
@@ -53,6 +123,8 @@ Machine::Machine()
     });
 
     QObject::connect(this, &Machine::started, this, [=](){
+        this->m_runClock.start();
+        this->m_runPausedTime = 0;
         if (this->running)
             return;
         this->running = true;
@@ -70,7 +142,8 @@ Machine::Machine()
 
 Machine::~Machine()
 {
-    stop();
+    // No time left to save the state
+    killQemu();
 }
 
 bool Machine::start()
@@ -142,10 +215,505 @@ bool Machine::start()
 
 void Machine::stop()
 {
-    kill(this->m_session->getShellPID(), SIGKILL);
+    if (this->m_suspending || this->m_shuttingDown)
+        return;
+
+    // A guest which hasn't finished loading its state yet has nothing new to save
+    if (this->suspendOnStop && canSuspend() && this->running &&
+            this->m_qmp->isReady() && !this->m_resuming) {
+        suspend();
+        return;
+    }
+
+    shutdown();
+}
+
+void Machine::shutdown()
+{
+    if (this->m_suspending || this->m_shuttingDown)
+        return;
+
+    // Without a control channel there's no one to ask
+    if (!this->running || !this->m_qmp->isReady()) {
+        killQemu();
+        return;
+    }
+
+    qDebug() << "Powering off" << this->name;
+    setShuttingDown(true);
+    this->m_stopTimer->start(this->shutdownTimeout);
+
+    // A paused guest can't react to the power button
+    if (isPaused())
+        this->m_qmp->execute(QStringLiteral("cont"));
+    this->m_qmp->execute(QStringLiteral("system_powerdown"), QJsonObject(), [=](const QJsonObject& reply) {
+        if (reply.contains(QStringLiteral("error")) && this->m_shuttingDown)
+            killQemu();
+    });
+}
+
+void Machine::forceStop()
+{
+    killQemu();
+}
+
+void Machine::pause()
+{
+    if (!this->m_qmp->isReady() || this->m_suspending || this->m_resuming)
+        return;
+    this->m_qmp->execute(QStringLiteral("stop"));
+}
+
+void Machine::resume()
+{
+    if (!this->m_qmp->isReady() || this->m_suspending || this->m_resuming)
+        return;
+    this->m_qmp->execute(QStringLiteral("cont"));
+}
+
+void Machine::refreshStatus()
+{
+    if (!this->m_qmp->isReady())
+        return;
+
+    this->m_qmp->execute(QStringLiteral("query-status"), QJsonObject(), [=](const QJsonObject& reply) {
+        if (reply.contains(QStringLiteral("error")))
+            return;
+        setStatus(reply.value(QStringLiteral("return")).toObject().value(QStringLiteral("status")).toString());
+    });
+}
+
+void Machine::updateAutoPause()
+{
+    const bool inactive = qGuiApp->applicationState() != Qt::ApplicationActive;
+    bool hidden = false;
+    if (this->pausePolicy == PauseWhenHidden)
+        hidden = inactive || !this->shown;
+    else if (this->pausePolicy == PauseWhenInactive)
+        hidden = inactive;
+
+    // Stopping and loading the state take care of the run state themselves
+    const bool busy = this->m_suspending || this->m_shuttingDown || this->m_resuming;
+
+    if (hidden && this->running && isControlReady() && !busy) {
+        // Paused by someone else already, that's theirs to undo
+        if (!this->m_autoPaused && this->m_status == QStringLiteral("running") &&
+                !this->m_autoPauseTimer->isActive())
+            this->m_autoPauseTimer->start();
+        return;
+    }
+
+    this->m_autoPauseTimer->stop();
+    if (this->m_autoPaused && !busy) {
+        resume();
+        endAutoPause();
+    }
+}
+
+void Machine::startAutoPause()
+{
+    if (!isControlReady() || this->m_status != QStringLiteral("running"))
+        return;
+
+    // The average load of the guest so far tells what pausing it saves
+    const qint64 activeTime = this->m_runClock.elapsed() - this->m_runPausedTime;
+    const qint64 cpuTime = processCpuTime();
+    this->m_cpuLoad = (activeTime > 0 && cpuTime >= 0) ? double(cpuTime) / activeTime : 0;
+
+    qDebug() << "Pausing" << this->name << "while it's hidden, load" << this->m_cpuLoad;
+    this->m_autoPaused = true;
+    this->m_autoPauseClock.start();
+    pause();
+    emit autoPauseChanged();
+}
+
+void Machine::endAutoPause()
+{
+    if (!this->m_autoPaused)
+        return;
+
+    const qint64 elapsed = this->m_autoPauseClock.elapsed();
+    this->m_autoPaused = false;
+    this->m_runPausedTime += elapsed;
+    this->m_pausedTime += elapsed;
+    this->m_cpuTimeSaved += static_cast<qint64>(elapsed * this->m_cpuLoad);
+    emit autoPauseChanged();
+}
+
+void Machine::updateBalloonTimer()
+{
+    if (this->autoBalloon && isControlReady())
+        this->m_balloonTimer->start();
+    else
+        this->m_balloonTimer->stop();
+}
+
+void Machine::adjustBalloon()
+{
+    // Nothing to negotiate with a stopped guest, nor before knowing the current size
+    if (this->m_status != QStringLiteral("running") || this->m_balloonTarget <= 0)
+        return;
+
+    const double pressure = hostMemoryPressure();
+    if (pressure < 0) {
+        qWarning() << "No memory pressure information, disabling the auto-balloon";
+        this->m_balloonTimer->stop();
+        return;
+    }
+
+    // Steps of an eighth of the memory, never going below half of it
+    const int step = qMax(this->mem / 8, 64);
+    const int floor = qMax(this->mem / 2, 256);
+
+    if (pressure > BALLOON_SHRINK_PRESSURE) {
+        this->m_calmTicks = 0;
+        if (this->m_balloonTarget > floor) {
+            qDebug() << "Host memory pressure" << pressure << ", shrinking" << this->name;
+            setBalloonTarget(qMax(this->m_balloonTarget - step, floor));
+        }
+    } else if (pressure < BALLOON_GROW_PRESSURE && this->m_balloonTarget < this->mem) {
+        if (++this->m_calmTicks >= BALLOON_GROW_TICKS) {
+            this->m_calmTicks = 0;
+            setBalloonTarget(qMin(this->m_balloonTarget + step, this->mem));
+        }
+    } else {
+        this->m_calmTicks = 0;
+    }
+}
+
+double Machine::hostMemoryPressure()
+{
+    // Pressure stall information: the share of time in which some task was
+    // waiting for memory, e.g. "some avg10=1.23 avg60=0.50 avg300=0.10 total=1234"
+    QFile psiFile(QStringLiteral("/proc/pressure/memory"));
+    if (psiFile.open(QFile::ReadOnly)) {
+        const QList<QByteArray> fields = psiFile.readLine().trimmed().split(' ');
+        if (fields.size() > 1 && fields.at(0) == "some" && fields.at(1).startsWith("avg10="))
+            return fields.at(1).mid(6).toDouble();
+    }
+
+    // Kernels without PSI: approximate from how little memory is left
+    QFile memInfoFile(QStringLiteral("/proc/meminfo"));
+    if (!memInfoFile.open(QFile::ReadOnly))
+        return -1;
+
+    qint64 total = 0;
+    qint64 available = -1;
+    while (!memInfoFile.atEnd()) {
+        const QList<QByteArray> fields = memInfoFile.readLine().simplified().split(' ');
+        if (fields.size() < 2)
+            continue;
+        if (fields.at(0) == "MemTotal:")
+            total = fields.at(1).toLongLong();
+        else if (fields.at(0) == "MemAvailable:")
+            available = fields.at(1).toLongLong();
+    }
+    if (total <= 0 || available < 0)
+        return -1;
+
+    // Scaled so that less than 10% available shrinks, and more than 19% grows
+    const double availableShare = 100.0 * available / total;
+    return qMax(0.0, BALLOON_SHRINK_PRESSURE * (20.0 - availableShare) / 10.0);
+}
+
+void Machine::applyCpuPlacement()
+{
+    if (!isControlReady())
+        return;
+
+    this->m_qmp->execute(QStringLiteral("query-cpus-fast"), QJsonObject(), [=](const QJsonObject& reply) {
+        if (reply.contains(QStringLiteral("error")))
+            return;
+
+        const QJsonArray vcpus = reply.value(QStringLiteral("return")).toArray();
+        const QList<QList<int>> placement = hostCpusForPlacement(vcpus.size());
+
+        // Left alone unless there's a placement to set or to undo
+        const bool pin = this->cpuPlacement != PlaceAnywhere || this->m_cpusPinned;
+        this->m_cpusPinned = this->cpuPlacement != PlaceAnywhere;
+
+        QVariantList layout;
+        for (int i = 0; i < vcpus.size(); i++) {
+            const QJsonObject vcpu = vcpus.at(i).toObject();
+            const int index = vcpu.value(QStringLiteral("cpu-index")).toInt();
+            const int thread = vcpu.value(QStringLiteral("thread-id")).toInt();
+            const QList<int>& hostCpus = placement.at(i);
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (const int hostCpu : hostCpus)
+                CPU_SET(hostCpu, &set);
+            if (pin && sched_setaffinity(thread, sizeof(set), &set) != 0) {
+                qWarning() << "Failed to pin vCPU" << index << "of" << this->name << ":" << strerror(errno);
+                continue;
+            }
+
+            QVariantList hostCpuList;
+            for (const int hostCpu : hostCpus)
+                hostCpuList << hostCpu;
+            QVariantMap entry;
+            entry.insert(QStringLiteral("vcpu"), index);
+            entry.insert(QStringLiteral("thread"), thread);
+            entry.insert(QStringLiteral("hostCpus"), hostCpuList);
+            layout << entry;
+        }
+
+        qDebug() << "vCPU layout of" << this->name << layout;
+        this->m_cpuLayout = layout;
+        emit cpuLayoutChanged();
+    });
+}
+
+QList<QList<int>> Machine::hostCpusForPlacement(int vcpus) const
+{
+    QList<int> candidates;
+    bool pinEach = true;
+
+    switch (this->cpuPlacement) {
+    case PlacePerformance:
+        candidates = CpuTopology::performanceCores();
+        break;
+    case PlaceEfficiency:
+        candidates = CpuTopology::efficiencyCores();
+        // Nothing to choose from on CPUs which are all alike
+        if (candidates.isEmpty())
+            candidates = CpuTopology::onlineCpus();
+        break;
+    case PlaceSpread:
+        candidates = CpuTopology::byPerformance();
+        break;
+    default:
+        // Undo any earlier pinning
+        candidates = CpuTopology::onlineCpus();
+        pinEach = false;
+        break;
+    }
+
+    // Each vCPU gets its own core, round-robin if there are more vCPUs than cores
+    QList<QList<int>> ret;
+    for (int i = 0; i < vcpus; i++) {
+        if (pinEach)
+            ret << QList<int>({candidates.at(i % candidates.size())});
+        else
+            ret << candidates;
+    }
+    return ret;
+}
+
+qint64 Machine::processCpuTime() const
+{
+    const int pid = this->m_session->getShellPID();
+    if (pid <= 0)
+        return -1;
+
+    QFile statFile(QStringLiteral("/proc/%1/stat").arg(pid));
+    if (!statFile.open(QFile::ReadOnly))
+        return -1;
+
+    // The command name may contain spaces, the fields after it don't.
+    // utime and stime are fields 14 and 15, counting from the pid.
+    const QByteArray stat = statFile.readAll();
+    const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13)
+        return -1;
+
+    const qint64 ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+    return ticks * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+void Machine::onQmpEvent(const QString& name, const QJsonObject& data)
+{
+    qDebug() << "QMP event:" << name << data;
+
+    // Resumed by someone else
+    if (name == QStringLiteral("RESUME") && this->m_autoPaused)
+        endAutoPause();
+
+    // The guest driver has given or taken memory
+    if (name == QStringLiteral("BALLOON_CHANGE")) {
+        this->m_balloonActual = data.value(QStringLiteral("actual")).toVariant().toLongLong() / (1024 * 1024);
+        emit balloonChanged();
+    }
+
+    // The run state changes with these, query the exact new one
+    if (name == QStringLiteral("STOP") || name == QStringLiteral("RESUME"))
+        refreshStatus();
+    else if (name == QStringLiteral("SHUTDOWN"))
+        setStatus(QStringLiteral("shutdown"));
+
+    emit qmpEvent(name, data.toVariantMap());
+}
+
+void Machine::setStatus(const QString& status)
+{
+    if (this->m_status == status)
+        return;
+    this->m_status = status;
+    emit statusChanged();
+}
+
+void Machine::setShuttingDown(bool shuttingDown)
+{
+    if (this->m_shuttingDown == shuttingDown)
+        return;
+    this->m_shuttingDown = shuttingDown;
+    emit shuttingDownChanged();
+}
+
+void Machine::killQemu()
+{
+    this->m_stopTimer->stop();
+    const int pid = this->m_session->getShellPID();
+    if (pid > 0)
+        kill(pid, SIGKILL);
     emit stopped();
 }
 
+void Machine::suspend()
+{
+    qDebug() << "Saving the state of" << this->name;
+    this->m_suspending = true;
+    emit suspendingChanged();
+    this->m_stopTimer->start(SUSPEND_TIMEOUT_MS);
+
+    // The guest must not change anymore while its memory is being written out
+    QFile::remove(getStateFile() + QStringLiteral(".part"));
+    this->m_qmp->execute(QStringLiteral("stop"));
+
+    // Migration is throttled to 32MiB/s by default, which is meant for networks
+    QJsonObject parameters;
+    parameters.insert(QStringLiteral("max-bandwidth"), static_cast<qint64>(1) << 40);
+    this->m_qmp->execute(QStringLiteral("migrate-set-parameters"), parameters);
+
+    QJsonObject migration;
+    migration.insert(QStringLiteral("uri"), QStringLiteral("exec:cat > '%1.part'").arg(getStateFile()));
+    this->m_qmp->execute(QStringLiteral("migrate"), migration, [=](const QJsonObject& reply) {
+        if (reply.contains(QStringLiteral("error"))) {
+            finishSuspend(false);
+            return;
+        }
+        pollMigration();
+    });
+}
+
+void Machine::pollMigration()
+{
+    if (!this->m_suspending)
+        return;
+
+    this->m_qmp->execute(QStringLiteral("query-migrate"), QJsonObject(), [=](const QJsonObject& reply) {
+        if (!this->m_suspending)
+            return;
+        if (reply.contains(QStringLiteral("error"))) {
+            finishSuspend(false);
+            return;
+        }
+
+        const QString status = reply.value(QStringLiteral("return")).toObject()
+                .value(QStringLiteral("status")).toString();
+        if (status == QStringLiteral("completed")) {
+            finishSuspend(true);
+        } else if (status == QStringLiteral("failed") || status == QStringLiteral("cancelled")) {
+            qWarning() << "Migration ended as" << status;
+            finishSuspend(false);
+        } else {
+            QTimer::singleShot(100, this, &Machine::pollMigration);
+        }
+    });
+}
+
+void Machine::finishSuspend(bool saved)
+{
+    const QString partialFile = getStateFile() + QStringLiteral(".part");
+
+    if (saved) {
+        // The state only fits the exact same command line, remember it next to it
+        QFile argsFile(getStateArgumentsFile());
+        if (argsFile.open(QFile::WriteOnly | QFile::Truncate)) {
+            argsFile.write(this->m_launchArgs.join('\n').toUtf8());
+            argsFile.close();
+            QFile::remove(getStateFile());
+            saved = QFile::rename(partialFile, getStateFile());
+        } else {
+            qWarning() << "Failed to write" << argsFile.fileName();
+            saved = false;
+        }
+    }
+
+    if (!saved) {
+        qWarning() << "Failed to save the state of" << this->name << ", powering off";
+        QFile::remove(partialFile);
+        discardSavedState();
+        killQemu();
+        return;
+    }
+
+    qDebug() << "Saved the state of" << this->name;
+    emit savedStateChanged();
+    this->m_qmp->execute(QStringLiteral("quit"));
+}
+
+void Machine::pollResume()
+{
+    if (!this->m_resuming)
+        return;
+
+    this->m_qmp->execute(QStringLiteral("query-status"), QJsonObject(), [=](const QJsonObject& reply) {
+        if (!this->m_resuming || reply.contains(QStringLiteral("error")))
+            return;
+
+        const QString status = reply.value(QStringLiteral("return")).toObject()
+                .value(QStringLiteral("status")).toString();
+        if (status == QStringLiteral("inmigrate")) {
+            QTimer::singleShot(100, this, &Machine::pollResume);
+            return;
+        }
+
+        // The guest was paused for saving it, and stays so after loading
+        if (status == QStringLiteral("paused"))
+            this->m_qmp->execute(QStringLiteral("cont"));
+
+        // The saved state is consumed once loaded
+        this->m_resuming = false;
+        discardSavedState();
+    });
+}
+
+void Machine::onQemuFinished()
+{
+    this->m_stopTimer->stop();
+    const bool wasReady = this->m_qmp->isReady();
+    this->m_qmp->disconnectFromServer();
+    if (wasReady)
+        emit controlReadyChanged();
+    setStatus(QString());
+    setShuttingDown(false);
+    this->m_autoPauseTimer->stop();
+    endAutoPause();
+    this->m_balloonTimer->stop();
+    this->m_balloonActual = 0;
+    this->m_balloonTarget = 0;
+    this->m_calmTicks = 0;
+    emit balloonChanged();
+    this->m_cpusPinned = false;
+    if (!this->m_cpuLayout.isEmpty()) {
+        this->m_cpuLayout.clear();
+        emit cpuLayoutChanged();
+    }
+
+    if (this->m_suspending) {
+        this->m_suspending = false;
+        emit suspendingChanged();
+    }
+
+    // QEMU exits right away if the state doesn't load, don't try it again
+    if (this->m_resuming) {
+        qWarning() << "Failed to resume" << this->name << "from its saved state";
+        this->m_resuming = false;
+        discardSavedState();
+    }
+}
+
 void Machine::importIntoShare(const QUrl& url) const
 {
     QFile file(url.path());
@@ -174,7 +742,17 @@ bool Machine::startQemu()
 {
     const QString pwd = QCoreApplication::applicationDirPath();
     const QString qemuBin = QStringLiteral("%1/bin/qemu-system-%2").arg(pwd, this->arch);
-    const QStringList args = getLaunchArguments();
+    QStringList args = getLaunchArguments();
+
+    // Resume from the saved state, if it was saved with the same configuration
+    this->m_launchArgs = args;
+    this->m_resuming = canResume(args);
+    if (this->m_resuming) {
+        args << QStringLiteral("-incoming") << QStringLiteral("exec:cat '%1'").arg(getStateFile());
+    } else if (hasSavedState()) {
+        qDebug() << "The configuration of" << this->name << "changed, discarding its saved state";
+        discardSavedState();
+    }
 
     if (this->enableFileSharing) {
         int counter = 0;
@@ -214,7 +792,9 @@ bool Machine::startQemu()
     this->m_session->setEnvironment(qemuEnv.toStringList());
     this->m_session->setShellProgram(qemuBin);
     this->m_session->setArgs(args);
+    QFile::remove(getControlSocket()); // May fail if it doesn't exist
     this->m_session->startShellProgram();
+    this->m_qmp->connectToServer(getControlSocket());
 
     return true;
 }
@@ -258,10 +838,19 @@ QStringList Machine::getLaunchArguments()
         ret << "-vga" << "virtio";
     }
 
+    // The D-Bus display shares the guest framebuffer with the app, as a memfd or,
+    // with virglrenderer, as a dmabuf the app must be able to import. A running
+    // QEMU can't switch to VNC when an import fails, so that only falls back to
+    // egl-headless and VNC from the next start on.
+    const bool dbusDisplay = !this->externalWindowOnly && this->sharedMemoryDisplay &&
+            (!this->useVirglrenderer || LomiriVNC::DmabufTexture::isSupported());
+
     // Configuration-specific display options
     if (!this->useVirglrenderer) {
         if (this->externalWindowOnly)
             ret << QStringLiteral("-display") << QStringLiteral("sdl");
+        else if (dbusDisplay)
+            ret << QStringLiteral("-display") << QStringLiteral("dbus,p2p=yes");
         else
             ret << QStringLiteral("-display") << QStringLiteral("egl-headless");
 
@@ -273,6 +862,8 @@ QStringList Machine::getLaunchArguments()
     } else {
         if (this->externalWindowOnly)
             ret << QStringLiteral("-display") << QStringLiteral("sdl,gl=es");
+        else if (dbusDisplay)
+            ret << QStringLiteral("-display") << QStringLiteral("dbus,p2p=yes,gl=es");
         else
             ret << QStringLiteral("-display") << QStringLiteral("egl-headless,gl=es");
 
@@ -325,6 +916,9 @@ QStringList Machine::getLaunchArguments()
             << QStringLiteral("-numa") << QStringLiteral("node,memdev=mem");
     }
 
+    // Lets the guest hand its free pages back, and the auto-balloon reclaim memory
+    ret << QStringLiteral("-device") << QStringLiteral("virtio-balloon-pci,id=balloon0,free-page-reporting=on");
+
     // Audio over PulseAudio
     ret << "-audiodev" << "pa,id=snd0";
     ret << "-device" << "intel-hda" << "-device" << "hda-output,audiodev=snd0";
@@ -335,9 +929,19 @@ QStringList Machine::getLaunchArguments()
 
     // We don't embed the VM monitor in the main app when using OpenGL
     if (!this->externalWindowOnly) {
-        ret << QStringLiteral("-vnc") << QStringLiteral("unix:%1").arg(QStringLiteral("%1/vnc.sock").arg(this->storage));
+        // QEMU refuses VNC next to a D-Bus display owning the GL context
+        if (!dbusDisplay || !this->useVirglrenderer)
+            ret << QStringLiteral("-vnc") << QStringLiteral("unix:%1").arg(QStringLiteral("%1/vnc.sock").arg(this->storage));
+
+        // The shared memory display is handed over through its own QMP monitor,
+        // VNC stays available as a fallback when there is one
+        if (dbusDisplay)
+            ret << QStringLiteral("-qmp") << QStringLiteral("unix:%1,server=on,wait=off").arg(getDisplaySocket());
     }
 
+    // Control channel, for suspending among others
+    ret << QStringLiteral("-qmp") << QStringLiteral("unix:%1,server=on,wait=off").arg(getControlSocket());
+
     // Disable all the unnecessary QEMU windows & consoles we don't use, but keep one serial console
     ret << "-parallel" << "none" << "-serial" << "mon:stdio";
 
@@ -389,6 +993,138 @@ QString Machine::getFileSharingSocket() const
     return path;
 }
 
+QString Machine::getDisplaySocket() const
+{
+    const QString path = QStringLiteral("%1/display.sock").arg(this->storage);
+    return path;
+}
+
+QString Machine::getControlSocket() const
+{
+    const QString path = QStringLiteral("%1/qmp.sock").arg(this->storage);
+    return path;
+}
+
+QString Machine::getStateFile() const
+{
+    const QString path = QStringLiteral("%1/suspend.state").arg(this->storage);
+    return path;
+}
+
+QString Machine::getStateArgumentsFile() const
+{
+    const QString path = QStringLiteral("%1/suspend.args").arg(this->storage);
+    return path;
+}
+
+bool Machine::canSuspend() const
+{
+    // vhost-user-fs and virgl's GPU state can't be migrated by QEMU.
+    // savevm isn't an alternative as it needs all drives to be qcow2,
+    // and the firmware flash drives are raw.
+    return !this->enableFileSharing && !this->useVirglrenderer;
+}
+
+bool Machine::hasSavedState() const
+{
+    return QFile::exists(getStateFile());
+}
+
+bool Machine::isSuspending() const
+{
+    return this->m_suspending;
+}
+
+bool Machine::isShuttingDown() const
+{
+    return this->m_shuttingDown;
+}
+
+bool Machine::isControlReady() const
+{
+    return this->m_qmp->isReady();
+}
+
+QString Machine::status() const
+{
+    return this->m_status;
+}
+
+bool Machine::isPaused() const
+{
+    return this->m_status == QStringLiteral("paused");
+}
+
+bool Machine::isAutoPaused() const
+{
+    return this->m_autoPaused;
+}
+
+qint64 Machine::pausedTime() const
+{
+    if (this->m_autoPaused)
+        return this->m_pausedTime + this->m_autoPauseClock.elapsed();
+    return this->m_pausedTime;
+}
+
+qint64 Machine::cpuTimeSaved() const
+{
+    if (this->m_autoPaused)
+        return this->m_cpuTimeSaved + static_cast<qint64>(this->m_autoPauseClock.elapsed() * this->m_cpuLoad);
+    return this->m_cpuTimeSaved;
+}
+
+int Machine::balloonActual() const
+{
+    return this->m_balloonActual;
+}
+
+int Machine::balloonTarget() const
+{
+    return this->m_balloonTarget;
+}
+
+void Machine::setBalloonTarget(int target)
+{
+    if (!isControlReady())
+        return;
+
+    target = qBound(64, target, this->mem);
+    QJsonObject arguments;
+    arguments.insert(QStringLiteral("value"), static_cast<qint64>(target) * 1024 * 1024);
+    this->m_qmp->execute(QStringLiteral("balloon"), arguments);
+
+    if (this->m_balloonTarget == target)
+        return;
+    this->m_balloonTarget = target;
+    emit balloonChanged();
+}
+
+QVariantList Machine::cpuLayout() const
+{
+    return this->m_cpuLayout;
+}
+
+bool Machine::canResume(const QStringList& args) const
+{
+    if (!hasSavedState() || !canSuspend())
+        return false;
+
+    QFile argsFile(getStateArgumentsFile());
+    if (!argsFile.open(QFile::ReadOnly))
+        return false;
+    return QString::fromUtf8(argsFile.readAll()) == args.join('\n');
+}
+
+void Machine::discardSavedState()
+{
+    const bool hadState = hasSavedState();
+    QFile::remove(getStateFile());
+    QFile::remove(getStateArgumentsFile());
+    if (hadState)
+        emit savedStateChanged();
+}
+
 QObject* Machine::session()
 {
     return this->m_session;
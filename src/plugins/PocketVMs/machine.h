@@ -17,13 +17,20 @@
 #ifndef MACHINE_H
 #define MACHINE_H
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QProcess>
 #include <QString>
 #include <QStringList>
 #include <QUrl>
+#include <QVariantList>
+#include <QVariantMap>
 #include <ksession.h>
 
+class QJsonObject;
+class QmpClient;
+class QTimer;
+
 class Machine: public QObject {
     Q_OBJECT
 
@@ -41,11 +48,46 @@ class Machine: public QObject {
     Q_PROPERTY(bool useVirglrenderer MEMBER useVirglrenderer NOTIFY useVirglrendererChanged)
     Q_PROPERTY(bool externalWindowOnly MEMBER externalWindowOnly NOTIFY externalWindowOnlyChanged)
     Q_PROPERTY(bool enableVirtualization MEMBER enableVirtualization NOTIFY enableVirtualizationChanged)
+    Q_PROPERTY(bool sharedMemoryDisplay MEMBER sharedMemoryDisplay NOTIFY sharedMemoryDisplayChanged)
+    Q_PROPERTY(bool suspendOnStop MEMBER suspendOnStop NOTIFY suspendOnStopChanged)
+    Q_PROPERTY(bool hasSavedState READ hasSavedState NOTIFY savedStateChanged)
+    Q_PROPERTY(bool suspending READ isSuspending NOTIFY suspendingChanged)
+    Q_PROPERTY(bool shuttingDown READ isShuttingDown NOTIFY shuttingDownChanged)
+    Q_PROPERTY(bool controlReady READ isControlReady NOTIFY controlReadyChanged)
+    Q_PROPERTY(QString status READ status NOTIFY statusChanged)
+    Q_PROPERTY(bool paused READ isPaused NOTIFY statusChanged)
+    Q_PROPERTY(int pausePolicy MEMBER pausePolicy NOTIFY pausePolicyChanged)
+    Q_PROPERTY(bool shown MEMBER shown NOTIFY shownChanged)
+    Q_PROPERTY(bool autoPaused READ isAutoPaused NOTIFY autoPauseChanged)
+    Q_PROPERTY(qint64 pausedTime READ pausedTime NOTIFY autoPauseChanged)
+    Q_PROPERTY(qint64 cpuTimeSaved READ cpuTimeSaved NOTIFY autoPauseChanged)
+    Q_PROPERTY(bool autoBalloon MEMBER autoBalloon NOTIFY autoBalloonChanged)
+    Q_PROPERTY(int balloonActual READ balloonActual NOTIFY balloonChanged)
+    Q_PROPERTY(int balloonTarget READ balloonTarget NOTIFY balloonChanged)
+    Q_PROPERTY(int cpuPlacement MEMBER cpuPlacement NOTIFY cpuPlacementChanged)
+    Q_PROPERTY(QVariantList cpuLayout READ cpuLayout NOTIFY cpuLayoutChanged)
 
     Q_PROPERTY(bool running MEMBER running NOTIFY runningChanged)
     Q_PROPERTY(QObject* session READ session NOTIFY sessionChanged);
 
 public:
+    // When to pause the vCPUs without being asked to
+    enum PausePolicy {
+        PauseNever = 0,
+        PauseWhenHidden, // not shown, or the app is in the background
+        PauseWhenInactive, // only while the app is in the background
+    };
+    Q_ENUM(PausePolicy)
+
+    // Which host CPUs the vCPU threads run on
+    enum CpuPlacement {
+        PlaceAnywhere = 0, // left to the scheduler
+        PlacePerformance, // on the big cores
+        PlaceEfficiency, // on the little cores
+        PlaceSpread, // one vCPU per core, big cores first
+    };
+    Q_ENUM(CpuPlacement)
+
     Machine();
     ~Machine();
 
@@ -61,6 +103,18 @@ public:
     bool useVirglrenderer = false;
     bool externalWindowOnly = false;
     bool enableVirtualization = false;
+    // Share the framebuffer with QEMU instead of going through VNC
+    bool sharedMemoryDisplay = false;
+    // Save the VM state on stop, and resume from it on the next start
+    bool suspendOnStop = false;
+    int pausePolicy = PauseNever;
+    // Whether the VM is on screen, maintained by the UI
+    bool shown = true;
+    // Take memory back from the guest while the host is under memory pressure
+    bool autoBalloon = false;
+    int cpuPlacement = PlaceAnywhere;
+    // How long the guest may take to power off after the ACPI request, in ms
+    int shutdownTimeout = 30000;
 
     bool running = false;
 
@@ -75,22 +129,100 @@ public:
     QString flash2;
 
     Q_INVOKABLE bool start();
+    // Suspends if configured, asks the guest to power off otherwise
     Q_INVOKABLE void stop();
+    // Powers off through ACPI, and kills QEMU if the guest doesn't comply in time
+    Q_INVOKABLE void shutdown();
+    Q_INVOKABLE void forceStop();
+    // Freezes and thaws the vCPUs
+    Q_INVOKABLE void pause();
+    Q_INVOKABLE void resume();
+    Q_INVOKABLE void refreshStatus();
     Q_INVOKABLE void importIntoShare(const QUrl& url) const;
 
     Q_INVOKABLE QString getFileSharingDirectory() const;
     Q_INVOKABLE QString getFileSharingSocket() const;
+    Q_INVOKABLE QString getDisplaySocket() const;
+    Q_INVOKABLE QString getControlSocket() const;
 
     Q_INVOKABLE bool canVirtualize() const;
 
+    // Devices which QEMU cannot migrate prevent suspending
+    Q_INVOKABLE bool canSuspend() const;
+    bool hasSavedState() const;
+    bool isSuspending() const;
+    bool isShuttingDown() const;
+    bool isControlReady() const;
+    // The QMP run state, e.g. "running" or "paused"; empty if unknown
+    QString status() const;
+    bool isPaused() const;
+    bool isAutoPaused() const;
+    // Cumulative, in milliseconds. The CPU time is an estimate
+    // based on how busy QEMU was while running.
+    qint64 pausedTime() const;
+    qint64 cpuTimeSaved() const;
+
+    // The guest memory size as set by the balloon, in MB; 0 if unknown
+    int balloonActual() const;
+    int balloonTarget() const;
+    Q_INVOKABLE void setBalloonTarget(int target);
+
+    // One entry per vCPU: its "vcpu" index, QEMU "thread" id and the
+    // "hostCpus" it may run on; empty while QEMU isn't running
+    QVariantList cpuLayout() const;
+    // Makes the next start a cold boot
+    Q_INVOKABLE void discardSavedState();
+
 private:
     bool startQemu();
     QStringList getLaunchArguments();
     static bool hasKvm();
     QObject* session();
+    QString getStateFile() const;
+    QString getStateArgumentsFile() const;
+    bool canResume(const QStringList& args) const;
+    void suspend();
+    void pollMigration();
+    void pollResume();
+    void finishSuspend(bool saved);
+    void onQemuFinished();
+    void onQmpEvent(const QString& name, const QJsonObject& data);
+    void setStatus(const QString& status);
+    void setShuttingDown(bool shuttingDown);
+    void updateAutoPause();
+    void startAutoPause();
+    void endAutoPause();
+    qint64 processCpuTime() const;
+    void updateBalloonTimer();
+    void adjustBalloon();
+    static double hostMemoryPressure();
+    void applyCpuPlacement();
+    QList<QList<int>> hostCpusForPlacement(int vcpus) const;
+    void killQemu();
 
     KSession* m_session = nullptr;
     QProcess* m_fileSharingProcess = nullptr;
+    QmpClient* m_qmp = nullptr;
+    QTimer* m_stopTimer = nullptr;
+    QStringList m_launchArgs; // of the running QEMU, without -incoming
+    bool m_resuming = false;
+    bool m_suspending = false;
+    bool m_shuttingDown = false;
+    QString m_status;
+    QTimer* m_autoPauseTimer = nullptr;
+    QElapsedTimer m_runClock;
+    QElapsedTimer m_autoPauseClock;
+    bool m_autoPaused = false;
+    qint64 m_runPausedTime = 0; // of the current QEMU process
+    double m_cpuLoad = 0; // CPU ms per ms before the current auto-pause
+    qint64 m_pausedTime = 0;
+    qint64 m_cpuTimeSaved = 0;
+    QTimer* m_balloonTimer = nullptr;
+    int m_balloonActual = 0;
+    int m_balloonTarget = 0;
+    int m_calmTicks = 0; // without memory pressure, since the last change
+    QVariantList m_cpuLayout;
+    bool m_cpusPinned = false;
 
 signals:
     void nameChanged();
@@ -107,6 +239,20 @@ signals:
     void useVirglrendererChanged();
     void externalWindowOnlyChanged();
     void enableVirtualizationChanged();
+    void sharedMemoryDisplayChanged();
+    void suspendOnStopChanged();
+    void savedStateChanged();
+    void suspendingChanged();
+    void shuttingDownChanged();
+    void controlReadyChanged();
+    void statusChanged();
+    void pausePolicyChanged();
+    void shownChanged();
+    void autoPauseChanged();
+    void autoBalloonChanged();
+    void balloonChanged();
+    void cpuPlacementChanged();
+    void cpuLayoutChanged();
 
     void runningChanged();
     void sessionChanged();
@@ -115,6 +261,8 @@ signals:
     void stopped();
     void error(QString err);
     void fileSharingError(QString err);
+    // Any asynchronous QMP event of the running QEMU
+    void qmpEvent(QString name, QVariantMap data);
 };
 
 #endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "path_watcher.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace LomiriVNC;
+
+PathWatcher::PathWatcher(QObject *parent):
+    QObject(parent),
+    m_fd(-1)
+{
+}
+
+PathWatcher::~PathWatcher()
+{
+    stop();
+}
+
+bool PathWatcher::watch(const QStringList &paths)
+{
+    stop();
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (Q_UNLIKELY(m_fd < 0)) {
+        qWarning() << "Could not initialize inotify:" << strerror(errno);
+        return false;
+    }
+
+    for (const QString &path: paths) {
+        const QFileInfo info(path);
+        const QString directory = info.absolutePath();
+        m_paths.append(info.absoluteFilePath());
+        if (m_directories.values().contains(directory)) continue;
+
+        /* A socket is created by bind(), or moved into place */
+        int wd = inotify_add_watch(m_fd, QFile::encodeName(directory),
+                                   IN_CREATE | IN_MOVED_TO);
+        if (wd < 0) {
+            qWarning() << "Cannot watch" << directory << strerror(errno);
+            continue;
+        }
+        m_directories.insert(wd, directory);
+    }
+    if (m_directories.isEmpty()) {
+        stop();
+        return false;
+    }
+
+    m_notifier.reset(new QSocketNotifier(m_fd, QSocketNotifier::Read));
+    QObject::connect(m_notifier.data(), &QSocketNotifier::activated,
+                     this, [this]() { onEvents(); });
+    return true;
+}
+
+void PathWatcher::stop()
+{
+    /* We might be called from the handler of the notifier */
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+        m_notifier.take()->deleteLater();
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_directories.clear();
+    m_paths.clear();
+}
+
+void PathWatcher::onEvents()
+{
+    alignas(inotify_event) char buffer[4096];
+    QStringList appeared;
+    ssize_t length;
+    while ((length = read(m_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length; ) {
+            const inotify_event *event =
+                reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+            if (event->len == 0) continue;
+
+            const QString path = m_directories.value(event->wd) +
+                QLatin1Char('/') + QFile::decodeName(event->name);
+            if (m_paths.contains(path) && !appeared.contains(path)) {
+                appeared.append(path);
+            }
+        }
+    }
+
+    /* The receivers may well stop or restart the watch */
+    for (const QString &path: appeared) {
+        Q_EMIT created(path);
+    }
+}
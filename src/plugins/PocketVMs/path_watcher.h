@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_PATH_WATCHER_H
+#define LOMIRIVNC_PATH_WATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+
+class QSocketNotifier;
+
+namespace LomiriVNC {
+
+/* Tells when some files appear, such as the sockets of a QEMU which is
+ * starting up, using inotify on their directories: no polling, and no
+ * delay between the creation and our reaction to it.
+ *
+ * Only the creation is reported: a socket file can exist well before (or
+ * long after) somebody listens on it, so the caller still has to be
+ * prepared for connections to fail.
+ */
+class PathWatcher: public QObject
+{
+    Q_OBJECT
+
+public:
+    PathWatcher(QObject *parent = nullptr);
+    ~PathWatcher();
+
+    /* Replaces the watched paths; returns false if none of their
+     * directories could be watched */
+    bool watch(const QStringList &paths);
+    void stop();
+
+Q_SIGNALS:
+    void created(const QString &path);
+
+private:
+    void onEvents();
+
+private:
+    int m_fd;
+    QScopedPointer<QSocketNotifier> m_notifier;
+    QHash<int, QString> m_directories; // by watch descriptor
+    QStringList m_paths;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_PATH_WATCHER_H
@@ -20,6 +20,7 @@
 #include "vmmanager.h"
 #include "vnc_client.h"
 #include "vnc_output.h"
+#include "vnc_stats.h"
 
 void ExamplePlugin::registerTypes(const char *uri) {
     //@uri VMManager
@@ -28,4 +29,6 @@ void ExamplePlugin::registerTypes(const char *uri) {
     using namespace LomiriVNC;
     qmlRegisterType<VncClient>(uri, 1, 0, "VncClient");
     qmlRegisterType<VncOutput>(uri, 1, 0, "VncOutput");
+    qmlRegisterUncreatableType<VncStats>(uri, 1, 0, "VncStats",
+                                         "Use VncClient.stats");
 }
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * pvms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonDocument>
+#include <QLocalSocket>
+
+#include "qmp_client.h"
+
+QmpClient::QmpClient(QObject* parent) : QObject(parent)
+{
+    this->m_socket = new QLocalSocket(this);
+    QObject::connect(this->m_socket, &QLocalSocket::readyRead, this, &QmpClient::onReadyRead);
+    QObject::connect(this->m_socket, &QLocalSocket::disconnected, this, [=](){
+        const bool wasReady = this->m_ready;
+        this->m_ready = false;
+        this->m_buffer.clear();
+        failPending();
+        if (wasReady)
+            emit disconnected();
+    });
+    QObject::connect(this->m_socket,
+                     static_cast<void (QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error),
+                     this, [=](QLocalSocket::LocalSocketError) {
+        // The socket is not there yet, or QEMU is not listening yet
+        if (this->m_ready || this->m_path.isEmpty())
+            return;
+        if (QDateTime::currentMSecsSinceEpoch() < this->m_deadline) {
+            this->m_retryTimer.start();
+        } else {
+            qWarning() << "Could not connect to QMP at" << this->m_path << this->m_socket->errorString();
+            failPending();
+        }
+    });
+
+    this->m_retryTimer.setSingleShot(true);
+    this->m_retryTimer.setInterval(100);
+    QObject::connect(&this->m_retryTimer, &QTimer::timeout, this, &QmpClient::tryConnect);
+}
+
+QmpClient::~QmpClient()
+{
+    // The owners of the callbacks might be going away as well
+    this->m_callbacks.clear();
+    disconnectFromServer();
+}
+
+void QmpClient::connectToServer(const QString& path, int timeoutMs)
+{
+    disconnectFromServer();
+    this->m_path = path;
+    this->m_deadline = QDateTime::currentMSecsSinceEpoch() + timeoutMs;
+    tryConnect();
+}
+
+void QmpClient::disconnectFromServer()
+{
+    this->m_path.clear();
+    this->m_retryTimer.stop();
+    this->m_ready = false;
+    this->m_socket->abort();
+    this->m_buffer.clear();
+    failPending();
+}
+
+bool QmpClient::isReady() const
+{
+    return this->m_ready;
+}
+
+void QmpClient::tryConnect()
+{
+    if (this->m_path.isEmpty())
+        return;
+    this->m_socket->abort();
+    this->m_socket->connectToServer(this->m_path);
+}
+
+void QmpClient::execute(const QString& command, const QJsonObject& arguments, Callback callback)
+{
+    const int id = this->m_nextId++;
+    QJsonObject message;
+    message.insert(QStringLiteral("execute"), command);
+    if (!arguments.isEmpty())
+        message.insert(QStringLiteral("arguments"), arguments);
+    message.insert(QStringLiteral("id"), id);
+    this->m_callbacks.insert(id, callback);
+
+    if (this->m_ready)
+        send(message);
+    else
+        this->m_queued.append(message);
+}
+
+QString QmpClient::errorString(const QJsonObject& reply)
+{
+    return reply.value(QStringLiteral("error")).toObject().value(QStringLiteral("desc")).toString();
+}
+
+void QmpClient::onReadyRead()
+{
+    this->m_buffer.append(this->m_socket->readAll());
+
+    // One JSON object per line
+    int newline;
+    while ((newline = this->m_buffer.indexOf('\n')) >= 0) {
+        const QByteArray line = this->m_buffer.left(newline);
+        this->m_buffer.remove(0, newline + 1);
+        const QJsonDocument doc = QJsonDocument::fromJson(line);
+        if (doc.isObject())
+            handleMessage(doc.object());
+    }
+}
+
+void QmpClient::handleMessage(const QJsonObject& message)
+{
+    // The greeting: negotiate, then release the queued commands
+    if (message.contains(QStringLiteral("QMP"))) {
+        QJsonObject negotiation;
+        negotiation.insert(QStringLiteral("execute"), QStringLiteral("qmp_capabilities"));
+        send(negotiation);
+        return;
+    }
+
+    if (message.contains(QStringLiteral("event"))) {
+        emit event(message.value(QStringLiteral("event")).toString(),
+                   message.value(QStringLiteral("data")).toObject());
+        return;
+    }
+
+    if (!message.contains(QStringLiteral("id"))) {
+        // The reply to qmp_capabilities
+        if (this->m_ready)
+            return;
+        this->m_ready = true;
+        const QList<QJsonObject> queued = this->m_queued;
+        this->m_queued.clear();
+        for (const QJsonObject& command : queued)
+            send(command);
+        emit ready();
+        return;
+    }
+
+    const int id = message.value(QStringLiteral("id")).toInt();
+    const Callback callback = this->m_callbacks.take(id);
+    if (message.contains(QStringLiteral("error")))
+        qWarning() << "QMP command" << id << "failed:" << errorString(message);
+    if (callback)
+        callback(message);
+}
+
+void QmpClient::send(const QJsonObject& message)
+{
+    this->m_socket->write(QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n');
+}
+
+void QmpClient::failPending()
+{
+    // Every pending command gets an answer, so that callers can clean up
+    QJsonObject error;
+    error.insert(QStringLiteral("desc"), QStringLiteral("QMP connection lost"));
+    QJsonObject reply;
+    reply.insert(QStringLiteral("error"), error);
+
+    const QHash<int, Callback> callbacks = this->m_callbacks;
+    this->m_callbacks.clear();
+    this->m_queued.clear();
+    for (const Callback& callback : callbacks) {
+        if (callback)
+            callback(reply);
+    }
+}
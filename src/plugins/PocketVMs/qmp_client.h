@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * pvms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QMPCLIENT_H
+#define QMPCLIENT_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <functional>
+
+class QLocalSocket;
+
+// Asynchronous client for the QEMU Machine Protocol of a running QEMU
+// (`-qmp unix:<path>,server=on,wait=off`).
+// Commands can be issued right away: they are held back until the
+// capabilities negotiation is over, and their replies are matched by id.
+class QmpClient: public QObject {
+    Q_OBJECT
+
+public:
+    // Receives the whole reply, which contains either "return" or "error"
+    typedef std::function<void(const QJsonObject& reply)> Callback;
+
+    QmpClient(QObject* parent = nullptr);
+    ~QmpClient();
+
+    // Keeps trying until QEMU has created the socket, or until the timeout
+    void connectToServer(const QString& path, int timeoutMs = 30000);
+    void disconnectFromServer();
+    bool isReady() const;
+
+    void execute(const QString& command,
+                 const QJsonObject& arguments = QJsonObject(),
+                 Callback callback = nullptr);
+
+    static QString errorString(const QJsonObject& reply);
+
+private:
+    void tryConnect();
+    void onReadyRead();
+    void handleMessage(const QJsonObject& message);
+    void send(const QJsonObject& message);
+    void failPending();
+
+    QLocalSocket* m_socket = nullptr;
+    QString m_path;
+    QTimer m_retryTimer;
+    qint64 m_deadline = 0;
+    QByteArray m_buffer;
+    bool m_ready = false;
+    int m_nextId = 0;
+    QHash<int, Callback> m_callbacks;
+    QList<QJsonObject> m_queued; // until ready
+
+signals:
+    void ready();
+    void disconnected();
+    void event(const QString& name, const QJsonObject& data);
+};
+
+#endif
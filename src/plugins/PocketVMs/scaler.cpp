@@ -63,6 +63,27 @@ QPointF Scaler::computeFitOffset(const QRectF &view, const QSizeF &objectSize)
     return QPointF(offsetX, offsetY);
 }
 
+Scaler::Scaler():
+    m_hasResult(false),
+    m_lastResult(false),
+    m_lastIn(),
+    m_lastOut()
+{
+}
+
+bool Scaler::map(const InputData &in, OutputData *out)
+{
+    if (!m_hasResult || in != m_lastIn) {
+        m_lastIn = in;
+        m_lastResult = updateMapping(in, &m_lastOut);
+        m_hasResult = true;
+    }
+    if (m_lastResult) {
+        *out = m_lastOut;
+    }
+    return m_lastResult;
+}
+
 bool Scaler::updateMapping(const InputData &in, OutputData *out)
 {
     QTransform itemToSource;
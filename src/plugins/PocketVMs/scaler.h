@@ -40,6 +40,13 @@ public:
         double requestedScale;
         QPointF requestedCenter; /* as offset from the source center, in source
                                     coordinates */
+
+        bool operator==(const InputData &o) const {
+            return sourceSize == o.sourceSize && itemSize == o.itemSize &&
+                requestedScale == o.requestedScale &&
+                requestedCenter == o.requestedCenter;
+        }
+        bool operator!=(const InputData &o) const { return !(*this == o); }
     };
 
     struct OutputData {
@@ -51,11 +58,22 @@ public:
         QTransform sourceToItem;
     };
 
+    Scaler();
+
+    /* Same as updateMapping(), but the result is remembered and returned
+     * again as long as the input doesn't change */
+    bool map(const InputData &in, OutputData *out);
+
     static bool updateMapping(const InputData &in, OutputData *out);
 
 private:
     friend class ::ScalerTest;
     static QPointF computeFitOffset(const QRectF &rect, const QSizeF &size);
+
+    bool m_hasResult;
+    bool m_lastResult;
+    InputData m_lastIn;
+    OutputData m_lastOut;
 };
 
 } // namespace
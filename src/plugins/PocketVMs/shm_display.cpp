@@ -0,0 +1,999 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "shm_display.h"
+
+#include "dmabuf_texture.h"
+#include "vnc_worker.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QPair>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* GLib uses "signals" as an identifier, which Qt defines as a keyword */
+#pragma push_macro("signals")
+#undef signals
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#pragma pop_macro("signals")
+
+using namespace LomiriVNC;
+
+static const char consolePath[] = "/org/qemu/Display1/Console_0";
+static const char listenerPath[] = "/org/qemu/Display1/Listener";
+static const char listenerInterface[] = "org.qemu.Display1.Listener";
+static const char mapInterface[] = "org.qemu.Display1.Listener.Unix.Map";
+static const char fdName[] = "pvms-display";
+static const int qmpTimeout = 5000; // ms
+static const int callTimeout = 1000; // ms
+
+static const char listenerXml[] =
+    "<node>"
+    "  <interface name='org.qemu.Display1.Listener'>"
+    "    <method name='Scanout'>"
+    "      <arg type='u' name='width' direction='in'/>"
+    "      <arg type='u' name='height' direction='in'/>"
+    "      <arg type='u' name='stride' direction='in'/>"
+    "      <arg type='u' name='pixman_format' direction='in'/>"
+    "      <arg type='ay' name='data' direction='in'/>"
+    "    </method>"
+    "    <method name='Update'>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "      <arg type='u' name='stride' direction='in'/>"
+    "      <arg type='u' name='pixman_format' direction='in'/>"
+    "      <arg type='ay' name='data' direction='in'/>"
+    "    </method>"
+    "    <method name='ScanoutDMABUF'>"
+    "      <arg type='h' name='dmabuf' direction='in'/>"
+    "      <arg type='u' name='width' direction='in'/>"
+    "      <arg type='u' name='height' direction='in'/>"
+    "      <arg type='u' name='stride' direction='in'/>"
+    "      <arg type='u' name='fourcc' direction='in'/>"
+    "      <arg type='t' name='modifier' direction='in'/>"
+    "      <arg type='b' name='y0_top' direction='in'/>"
+    "    </method>"
+    "    <method name='UpdateDMABUF'>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "    </method>"
+    "    <method name='Disable'/>"
+    "    <method name='MouseSet'>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='on' direction='in'/>"
+    "    </method>"
+    "    <method name='CursorDefine'>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "      <arg type='i' name='hot_x' direction='in'/>"
+    "      <arg type='i' name='hot_y' direction='in'/>"
+    "      <arg type='ay' name='data' direction='in'/>"
+    "    </method>"
+    "    <property name='Interfaces' type='as' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.qemu.Display1.Listener.Unix.Map'>"
+    "    <method name='ScanoutMap'>"
+    "      <arg type='h' name='memfd' direction='in'/>"
+    "      <arg type='u' name='offset' direction='in'/>"
+    "      <arg type='u' name='width' direction='in'/>"
+    "      <arg type='u' name='height' direction='in'/>"
+    "      <arg type='u' name='stride' direction='in'/>"
+    "      <arg type='u' name='pixman_format' direction='in'/>"
+    "    </method>"
+    "    <method name='UpdateMap'>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+/* The pixman formats QEMU uses for its surfaces */
+enum {
+    PixmanX8R8G8B8 = 0x20020888,
+    PixmanA8R8G8B8 = 0x20028888,
+    PixmanR5G6B5 = 0x10020565,
+};
+
+/* QEMU's InputButton */
+enum {
+    ButtonLeft = 0,
+    ButtonMiddle = 1,
+    ButtonRight = 2,
+};
+
+static QImage::Format imageFormat(quint32 pixmanFormat)
+{
+    switch (pixmanFormat) {
+    case PixmanX8R8G8B8:
+    case PixmanA8R8G8B8:
+        return QImage::Format_RGB32;
+    case PixmanR5G6B5:
+        return QImage::Format_RGB16;
+    default:
+        return QImage::Format_Invalid;
+    }
+}
+
+static gboolean quitLoop(void *loop)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(loop));
+    return G_SOURCE_REMOVE;
+}
+
+static void unmapSurface(void *info)
+{
+    QPair<void*, size_t> *mapping = static_cast<QPair<void*, size_t>*>(info);
+    munmap(mapping->first, mapping->second);
+    delete mapping;
+}
+
+/* QMP, just enough for handing a socket over to the D-Bus display */
+
+static bool qmpSend(int socket, const QByteArray &command, int fd)
+{
+    iovec iov;
+    iov.iov_base = const_cast<char*>(command.constData());
+    iov.iov_len = command.size();
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == command.size();
+}
+
+/* `cancelFd` becomes readable when the handshake is interrupted */
+static bool qmpRead(int socket, int cancelFd, QByteArray *buffer,
+                    QJsonObject *reply)
+{
+    int newline;
+    while ((newline = buffer->indexOf('\n')) < 0) {
+        pollfd fds[2] = {
+            { socket, POLLIN, 0 },
+            { cancelFd, POLLIN, 0 },
+        };
+        int ret = poll(fds, 2, qmpTimeout);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0 || fds[1].revents) return false;
+        char data[4096];
+        ssize_t length = recv(socket, data, sizeof(data), 0);
+        if (length <= 0) return false;
+        buffer->append(data, length);
+    }
+    *reply = QJsonDocument::fromJson(buffer->left(newline)).object();
+    buffer->remove(0, newline + 1);
+    return true;
+}
+
+static bool qmpExecute(int socket, int cancelFd, QByteArray *buffer,
+                       const QByteArray &command, int fd = -1)
+{
+    if (!qmpSend(socket, command, fd)) return false;
+
+    QJsonObject reply;
+    while (qmpRead(socket, cancelFd, buffer, &reply)) {
+        if (reply.contains(QStringLiteral("return"))) return true;
+        if (reply.contains(QStringLiteral("error"))) {
+            qWarning() << "QMP command failed:" << command <<
+                reply.value(QStringLiteral("error")).toObject()
+                .value(QStringLiteral("desc")).toString();
+            return false;
+        }
+        /* The greeting, or an event */
+    }
+    qWarning() << "No reply from QMP to" << command;
+    return false;
+}
+
+/* Returns our end of a socket connected to the D-Bus display */
+static int addDisplayClient(const QString &qmpSocket, int cancelFd)
+{
+    QByteArray path = QFile::encodeName(qmpSocket);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.size() >= int(sizeof(address.sun_path))) {
+        qWarning() << "Socket path too long:" << qmpSocket;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.constData(), path.size());
+
+    int qmp = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (qmp < 0) return -1;
+    if (::connect(qmp, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)) < 0) {
+        qWarning() << "Could not connect to" << qmpSocket << strerror(errno);
+        ::close(qmp);
+        return -1;
+    }
+
+    int pair[2] = { -1, -1 };
+    QByteArray buffer;
+    bool ok = qmpExecute(qmp, cancelFd, &buffer,
+                         "{\"execute\":\"qmp_capabilities\"}") &&
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == 0 &&
+        qmpExecute(qmp, cancelFd, &buffer,
+                   QByteArray("{\"execute\":\"getfd\",\"arguments\":"
+                              "{\"fdname\":\"") + fdName + "\"}}",
+                   pair[1]) &&
+        qmpExecute(qmp, cancelFd, &buffer,
+                   QByteArray("{\"execute\":\"add_client\",\"arguments\":"
+                              "{\"protocol\":\"@dbus-display\","
+                              "\"fdname\":\"") + fdName + "\"}}");
+    ::close(qmp);
+    if (pair[1] >= 0) ::close(pair[1]);
+    if (!ok) {
+        if (pair[0] >= 0) ::close(pair[0]);
+        return -1;
+    }
+    return pair[0];
+}
+
+/* X keysyms to QEMU key numbers (the PC scancodes, with 0x80 set for the
+ * extended ones), for a US layout */
+static const char unshiftedKeys[] =
+    "1234567890-=qwertyuiop[]asdfghjkl;'`\\zxcvbnm,./";
+static const char shiftedKeys[] =
+    "!@#$%^&*()_+QWERTYUIOP{}ASDFGHJKL:\"~|ZXCVBNM<>?";
+static const quint8 keyCodes[] = {
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+    0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29,
+    0x2b,
+    0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35,
+};
+static const uint32_t qnumShift = 0x2a;
+
+static uint32_t keysymToQnum(uint32_t keysym, bool *shift)
+{
+    *shift = false;
+    if (keysym > 0x20 && keysym < 0x7f) {
+        const char c = char(keysym);
+        if (const char *p = strchr(unshiftedKeys, c)) {
+            return keyCodes[p - unshiftedKeys];
+        }
+        if (const char *p = strchr(shiftedKeys, c)) {
+            *shift = true;
+            return keyCodes[p - shiftedKeys];
+        }
+    }
+    if (keysym >= XK_F1 && keysym <= XK_F10) return 0x3b + keysym - XK_F1;
+
+    switch (keysym) {
+    case XK_space: case XK_KP_Space: return 0x39;
+    case XK_Escape: return 0x01;
+    case XK_BackSpace: return 0x0e;
+    case XK_Tab: return 0x0f;
+    case XK_Return: return 0x1c;
+    case XK_Control_L: return 0x1d;
+    case XK_Shift_L: return 0x2a;
+    case XK_Shift_R: return 0x36;
+    case XK_Alt_L: case XK_Meta_L: return 0x38;
+    case XK_Caps_Lock: return 0x3a;
+    case XK_Num_Lock: return 0x45;
+    case XK_Scroll_Lock: return 0x46;
+    case XK_F11: return 0x57;
+    case XK_F12: return 0x58;
+    case XK_Control_R: return 0x9d;
+    case XK_Print: case XK_Sys_Req: return 0xb7;
+    case XK_Alt_R: return 0xb8;
+    case XK_Pause: return 0xc6;
+    case XK_Home: return 0xc7;
+    case XK_Up: return 0xc8;
+    case XK_Page_Up: return 0xc9;
+    case XK_Left: return 0xcb;
+    case XK_Right: return 0xcd;
+    case XK_End: return 0xcf;
+    case XK_Down: return 0xd0;
+    case XK_Page_Down: return 0xd1;
+    case XK_Insert: return 0xd2;
+    case XK_Delete: return 0xd3;
+    case XK_Super_L: return 0xdb;
+    case XK_Super_R: return 0xdc;
+    case XK_Menu: return 0xdd;
+    default: return 0;
+    }
+}
+
+ShmDisplay::ShmDisplay():
+    QThread(),
+    m_context(nullptr),
+    m_loop(nullptr),
+    m_cancellable(nullptr),
+    m_attempt(0),
+    m_connection(nullptr),
+    m_listenerConnection(nullptr),
+    m_closing(false),
+    m_surfaceBits(nullptr),
+    m_cursorVisible(true),
+    m_pendingDmabufUpdate(nullptr),
+    m_framePending(false),
+    m_updatesWanted(true),
+    m_lastButtonMask(0)
+{
+    m_registrations[0] = m_registrations[1] = 0;
+    setObjectName("Display");
+}
+
+ShmDisplay::~ShmDisplay()
+{
+    disconnect();
+}
+
+GDBusConnection *ShmDisplay::openConnection(int fd, bool delayMessages)
+{
+    GError *error = nullptr;
+    GSocket *socket = g_socket_new_from_fd(fd, &error);
+    if (!socket) {
+        qWarning() << "Invalid display socket:" << error->message;
+        g_error_free(error);
+        ::close(fd);
+        return nullptr;
+    }
+    GSocketConnection *stream =
+        g_socket_connection_factory_create_connection(socket);
+    g_object_unref(socket);
+
+    int flags = G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT;
+    if (delayMessages) flags |= G_DBUS_CONNECTION_FLAGS_DELAY_MESSAGE_PROCESSING;
+    GDBusConnection *connection =
+        g_dbus_connection_new_sync(G_IO_STREAM(stream), nullptr,
+                                   GDBusConnectionFlags(flags),
+                                   nullptr, m_cancellable, &error);
+    g_object_unref(stream);
+    if (!connection) {
+        qWarning() << "D-Bus display handshake failed:" << error->message;
+        g_error_free(error);
+        return nullptr;
+    }
+    g_signal_connect(connection, "closed",
+                     G_CALLBACK(onConnectionClosed), this);
+    return connection;
+}
+
+void ShmDisplay::connectToDisplay(const QString &qmpSocket,
+                                  const Callback &callback)
+{
+    disconnect();
+
+    /* The handshake takes a few round trips to QEMU, each of which can
+     * take a while if it's busy booting: it happens in our thread, where
+     * all the callbacks are dispatched too */
+    m_qmpSocket = qmpSocket;
+    m_callback = callback;
+    m_cancellable = g_cancellable_new();
+    m_context = g_main_context_new();
+    m_loop = g_main_loop_new(m_context, FALSE);
+    m_attempt++;
+    start();
+}
+
+/* Runs in our thread */
+bool ShmDisplay::openDisplay()
+{
+    int cancelFd = g_cancellable_get_fd(m_cancellable);
+    int fd = addDisplayClient(m_qmpSocket, cancelFd);
+    g_cancellable_release_fd(m_cancellable);
+    if (fd < 0) return false;
+
+    m_connection = openConnection(fd, false);
+    /* QEMU queries our properties while registering the listener: they
+     * are answered once the main loop runs */
+    return m_connection && registerListener();
+}
+
+bool ShmDisplay::registerListener()
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        qWarning() << "Could not create socket pair:" << strerror(errno);
+        return false;
+    }
+
+    /* QEMU authenticates the new connection before replying, so the call
+     * can't be waited for */
+    GUnixFDList *fds = g_unix_fd_list_new_from_array(&pair[1], 1);
+    g_dbus_connection_call_with_unix_fd_list(
+        m_connection, nullptr, consolePath, "org.qemu.Display1.Console",
+        "RegisterListener", g_variant_new("(h)", 0), nullptr,
+        G_DBUS_CALL_FLAGS_NONE, -1, fds, nullptr,
+        onListenerRegistered, this);
+    g_object_unref(fds);
+
+    m_listenerConnection = openConnection(pair[0], true);
+    if (!m_listenerConnection) return false;
+
+    static GDBusNodeInfo *node =
+        g_dbus_node_info_new_for_xml(listenerXml, nullptr);
+    static const GDBusInterfaceVTable vtable = {
+        handleMethodCall, getProperty, nullptr, { nullptr },
+    };
+    for (int i = 0; i < 2; i++) {
+        GError *error = nullptr;
+        m_registrations[i] = g_dbus_connection_register_object(
+            m_listenerConnection, listenerPath, node->interfaces[i],
+            &vtable, this, nullptr, &error);
+        if (!m_registrations[i]) {
+            qWarning() << "Could not register the listener:" <<
+                error->message;
+            g_error_free(error);
+            return false;
+        }
+    }
+    g_dbus_connection_start_message_processing(m_listenerConnection);
+    return true;
+}
+
+void ShmDisplay::disconnect()
+{
+    m_closing = true;
+    if (m_cancellable) g_cancellable_cancel(m_cancellable);
+    if (m_loop) {
+        /* The loop might not be running yet, if the handshake is still
+         * going on: then it quits as soon as it starts */
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, quitLoop, m_loop, nullptr);
+        g_source_attach(source, m_context);
+        g_source_unref(source);
+        wait();
+    }
+    m_attempt++;
+    m_callback = nullptr;
+    if (m_pendingDmabufUpdate) {
+        g_dbus_method_invocation_return_value(m_pendingDmabufUpdate, nullptr);
+        m_pendingDmabufUpdate = nullptr;
+    }
+
+    if (m_listenerConnection) {
+        for (unsigned &id: m_registrations) {
+            if (id) g_dbus_connection_unregister_object(m_listenerConnection,
+                                                        id);
+            id = 0;
+        }
+        g_signal_handlers_disconnect_by_data(m_listenerConnection, this);
+        g_dbus_connection_close_sync(m_listenerConnection, nullptr, nullptr);
+        g_object_unref(m_listenerConnection);
+        m_listenerConnection = nullptr;
+    }
+    if (m_connection) {
+        g_signal_handlers_disconnect_by_data(m_connection, this);
+        g_dbus_connection_close_sync(m_connection, nullptr, nullptr);
+        g_object_unref(m_connection);
+        m_connection = nullptr;
+    }
+    if (m_loop) {
+        g_main_loop_unref(m_loop);
+        m_loop = nullptr;
+    }
+    if (m_context) {
+        g_main_context_unref(m_context);
+        m_context = nullptr;
+    }
+    if (m_cancellable) {
+        g_object_unref(m_cancellable);
+        m_cancellable = nullptr;
+    }
+    m_closing = false;
+
+    m_surface = QImage();
+    m_surfaceBits = nullptr;
+    m_cursor = QImage();
+    m_cursorVisible = true;
+    m_lastButtonMask = 0;
+    QMutexLocker locker(&m_mutex);
+    m_latest = QImage();
+    m_latestDmabuf.reset();
+    m_damage = QRegion();
+    m_pendingStats = VncFrameStats();
+    m_framePending = false;
+}
+
+void ShmDisplay::run()
+{
+    g_main_context_push_thread_default(m_context);
+
+    const bool ok = openDisplay();
+    const int attempt = m_attempt;
+    QMetaObject::invokeMethod(this, [this, attempt, ok]() {
+        /* Interrupted by disconnect() */
+        if (attempt != m_attempt) return;
+        Callback callback = m_callback;
+        if (!ok) disconnect();
+        callback(ok);
+    }, Qt::QueuedConnection);
+
+    if (ok) g_main_loop_run(m_loop);
+    g_main_context_pop_thread_default(m_context);
+}
+
+void ShmDisplay::onListenerRegistered(GObject *source, GAsyncResult *result,
+                                      void *userData)
+{
+    GError *error = nullptr;
+    GVariant *reply = g_dbus_connection_call_with_unix_fd_list_finish(
+        G_DBUS_CONNECTION(source), nullptr, result, &error);
+    if (reply) {
+        g_variant_unref(reply);
+        return;
+    }
+    qWarning() << "Could not register the display listener:" <<
+        error->message;
+    g_error_free(error);
+    ShmDisplay *display = static_cast<ShmDisplay*>(userData);
+    Q_EMIT display->disconnected();
+}
+
+void ShmDisplay::onConnectionClosed(GDBusConnection *connection,
+                                    int remotePeerVanished, GError *error,
+                                    void *userData)
+{
+    Q_UNUSED(connection);
+    Q_UNUSED(remotePeerVanished);
+    Q_UNUSED(error);
+    ShmDisplay *display = static_cast<ShmDisplay*>(userData);
+    if (!display->m_closing) Q_EMIT display->disconnected();
+}
+
+GVariant *ShmDisplay::getProperty(GDBusConnection *connection,
+                                  const char *sender, const char *objectPath,
+                                  const char *interfaceName,
+                                  const char *propertyName,
+                                  GError **error, void *userData)
+{
+    Q_UNUSED(connection);
+    Q_UNUSED(sender);
+    Q_UNUSED(objectPath);
+    Q_UNUSED(interfaceName);
+    Q_UNUSED(userData);
+    if (strcmp(propertyName, "Interfaces") != 0) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                    "Unknown property %s", propertyName);
+        return nullptr;
+    }
+    const char *interfaces[] = { mapInterface, nullptr };
+    return g_variant_new_strv(interfaces, -1);
+}
+
+void ShmDisplay::handleMethodCall(GDBusConnection *connection,
+                                  const char *sender, const char *objectPath,
+                                  const char *interfaceName,
+                                  const char *methodName,
+                                  GVariant *parameters,
+                                  GDBusMethodInvocation *invocation,
+                                  void *userData)
+{
+    Q_UNUSED(connection);
+    Q_UNUSED(sender);
+    Q_UNUSED(objectPath);
+    ShmDisplay *display = static_cast<ShmDisplay*>(userData);
+
+    bool ok = true;
+    if (strcmp(interfaceName, mapInterface) == 0) {
+        if (strcmp(methodName, "ScanoutMap") == 0) {
+            ok = display->onScanoutMap(parameters, invocation);
+        } else if (strcmp(methodName, "UpdateMap") == 0) {
+            gint32 x, y, w, h;
+            g_variant_get(parameters, "(iiii)", &x, &y, &w, &h);
+            display->addDamage(QRect(x, y, w, h), VncFrameStats());
+        }
+    } else if (strcmp(interfaceName, listenerInterface) == 0) {
+        if (strcmp(methodName, "Scanout") == 0) {
+            ok = display->onScanout(parameters);
+        } else if (strcmp(methodName, "Update") == 0) {
+            ok = display->onUpdate(parameters);
+        } else if (strcmp(methodName, "ScanoutDMABUF") == 0) {
+            ok = display->onScanoutDmabuf(parameters, invocation);
+        } else if (strcmp(methodName, "UpdateDMABUF") == 0) {
+            /* Answered later */
+            display->onUpdateDmabuf(parameters, invocation);
+            return;
+        } else if (strcmp(methodName, "Disable") == 0) {
+            display->setSurface(QImage(), VncFrameStats());
+        } else if (strcmp(methodName, "CursorDefine") == 0) {
+            display->onCursorDefine(parameters);
+        } else if (strcmp(methodName, "MouseSet") == 0) {
+            display->onMouseSet(parameters);
+        }
+    }
+
+    if (ok) {
+        g_dbus_method_invocation_return_value(invocation, nullptr);
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "Unsupported surface");
+    }
+}
+
+bool ShmDisplay::onScanoutMap(GVariant *parameters,
+                              GDBusMethodInvocation *invocation)
+{
+    gint32 handle;
+    guint32 offset, width, height, stride, pixmanFormat;
+    g_variant_get(parameters, "(huuuuu)", &handle, &offset,
+                  &width, &height, &stride, &pixmanFormat);
+
+    const QImage::Format format = imageFormat(pixmanFormat);
+    GUnixFDList *fds = g_dbus_message_get_unix_fd_list(
+        g_dbus_method_invocation_get_message(invocation));
+    if (format == QImage::Format_Invalid || !fds) {
+        qWarning() << "Unsupported shared surface, format" <<
+            QString::number(pixmanFormat, 16);
+        return false;
+    }
+    int fd = g_unix_fd_list_get(fds, handle, nullptr);
+    if (fd < 0) return false;
+
+    const size_t size = size_t(offset) + size_t(stride) * height;
+    void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        qWarning() << "Could not map the display surface:" << strerror(errno);
+        return false;
+    }
+
+    /* The mapping goes away with the last copy of the image, which might
+     * well be held by the GUI thread */
+    QImage image(static_cast<const uchar*>(address) + offset,
+                 width, height, stride, format, unmapSurface,
+                 new QPair<void*, size_t>(address, size));
+    m_surfaceBits = nullptr;
+    setSurface(image, VncFrameStats());
+    return true;
+}
+
+void ShmDisplay::onCursorDefine(GVariant *parameters)
+{
+    gint32 width, height, xHot, yHot;
+    GVariant *data;
+    g_variant_get(parameters, "(iiii@ay)", &width, &height, &xHot, &yHot,
+                  &data);
+
+    gsize length;
+    const void *pixels = g_variant_get_fixed_array(data, &length, 1);
+    if (width > 0 && height > 0 && length >= gsize(width) * height * 4) {
+        /* Straight alpha; converting also detaches from the message */
+        m_cursor = QImage(static_cast<const uchar*>(pixels), width, height,
+                          width * 4, QImage::Format_ARGB32)
+            .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        m_cursorHotspot = QPoint(xHot, yHot);
+    } else {
+        m_cursor = QImage();
+    }
+    g_variant_unref(data);
+
+    if (m_cursorVisible) Q_EMIT cursorChanged(m_cursor, m_cursorHotspot);
+}
+
+void ShmDisplay::onMouseSet(GVariant *parameters)
+{
+    /* The guest moves the pointer only for absolute devices we drive
+     * ourselves: just follow the visibility */
+    gint32 x, y, on;
+    g_variant_get(parameters, "(iii)", &x, &y, &on);
+    if (bool(on) == m_cursorVisible) return;
+    m_cursorVisible = on;
+    Q_EMIT cursorChanged(on ? m_cursor : QImage(), m_cursorHotspot);
+}
+
+bool ShmDisplay::onScanoutDmabuf(GVariant *parameters,
+                                 GDBusMethodInvocation *invocation)
+{
+    gint32 handle;
+    guint32 width, height, stride, fourcc;
+    guint64 modifier;
+    gboolean y0Top;
+    g_variant_get(parameters, "(huuuutb)", &handle, &width, &height,
+                  &stride, &fourcc, &modifier, &y0Top);
+
+    GUnixFDList *fds = g_dbus_message_get_unix_fd_list(
+        g_dbus_method_invocation_get_message(invocation));
+    int fd = fds ? g_unix_fd_list_get(fds, handle, nullptr) : -1;
+    if (fd < 0) return false;
+
+    QSharedPointer<DmabufBuffer> buffer(new DmabufBuffer);
+    buffer->fd = fd;
+    buffer->size = QSize(width, height);
+    buffer->stride = stride;
+    buffer->fourcc = fourcc;
+    buffer->modifier = modifier;
+    buffer->y0Top = y0Top;
+    setDmabuf(buffer);
+    return true;
+}
+
+void ShmDisplay::onUpdateDmabuf(GVariant *parameters,
+                                GDBusMethodInvocation *invocation)
+{
+    gint32 x, y, w, h;
+    g_variant_get(parameters, "(iiii)", &x, &y, &w, &h);
+
+    /* QEMU doesn't render the next frame until we answer: do that when the
+     * GUI takes this one, so that the guest runs at the display rate. */
+    GDBusMethodInvocation *previous;
+    {
+        QMutexLocker locker(&m_mutex);
+        previous = m_pendingDmabufUpdate;
+        m_pendingDmabufUpdate = invocation;
+        if (!m_updatesWanted) {
+            previous = invocation;
+            m_pendingDmabufUpdate = nullptr;
+        }
+    }
+    if (previous) g_dbus_method_invocation_return_value(previous, nullptr);
+    addDamage(QRect(x, y, w, h), VncFrameStats());
+}
+
+bool ShmDisplay::onScanout(GVariant *parameters)
+{
+    guint32 width, height, stride, pixmanFormat;
+    GVariant *data;
+    g_variant_get(parameters, "(uuuu@ay)", &width, &height, &stride,
+                  &pixmanFormat, &data);
+
+    QElapsedTimer timer;
+    timer.start();
+    VncFrameStats stats;
+    stats.readableAt = VncStats::timestamp();
+
+    gsize size;
+    const uchar *bytes = static_cast<const uchar*>(
+        g_variant_get_fixed_array(data, &size, 1));
+    const QImage::Format format = imageFormat(pixmanFormat);
+    bool ok = format != QImage::Format_Invalid &&
+        size >= gsize(stride) * height;
+    if (ok) {
+        QImage image(width, height, format);
+        /* Written in place by the updates, without detaching */
+        m_surfaceBits = const_cast<uchar*>(image.constBits());
+        const int lineLength = qMin<int>(stride, image.bytesPerLine());
+        for (guint32 y = 0; y < height; y++) {
+            memcpy(m_surfaceBits + y * image.bytesPerLine(),
+                   bytes + y * stride, lineLength);
+        }
+        stats.bytes = size;
+        stats.decodeTime = timer.nsecsElapsed();
+        setSurface(image, stats);
+    }
+    g_variant_unref(data);
+    return ok;
+}
+
+bool ShmDisplay::onUpdate(GVariant *parameters)
+{
+    gint32 x, y, w, h;
+    guint32 stride, pixmanFormat;
+    GVariant *data;
+    g_variant_get(parameters, "(iiiiuu@ay)", &x, &y, &w, &h, &stride,
+                  &pixmanFormat, &data);
+
+    QElapsedTimer timer;
+    timer.start();
+    VncFrameStats stats;
+    stats.readableAt = VncStats::timestamp();
+
+    gsize size;
+    const uchar *bytes = static_cast<const uchar*>(
+        g_variant_get_fixed_array(data, &size, 1));
+    const QRect rect(x, y, w, h);
+    bool ok = m_surfaceBits &&
+        imageFormat(pixmanFormat) == m_surface.format() &&
+        m_surface.rect().contains(rect) &&
+        size >= gsize(stride) * h;
+    if (ok) {
+        const int bytesPerPixel = m_surface.depth() / 8;
+        const int bytesPerLine = m_surface.bytesPerLine();
+        for (int row = 0; row < h; row++) {
+            memcpy(m_surfaceBits + (y + row) * bytesPerLine +
+                   x * bytesPerPixel,
+                   bytes + row * stride, w * bytesPerPixel);
+        }
+        stats.bytes = size;
+        stats.decodeTime = timer.nsecsElapsed();
+        addDamage(rect, stats);
+    }
+    g_variant_unref(data);
+    return ok;
+}
+
+void ShmDisplay::setSurface(const QImage &image, const VncFrameStats &stats)
+{
+    m_surface = image;
+    if (image.isNull()) m_surfaceBits = nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    m_latest = image;
+    m_latestDmabuf.reset();
+    m_damage = image.rect();
+    publish(stats);
+}
+
+void ShmDisplay::setDmabuf(const QSharedPointer<const DmabufBuffer> &buffer)
+{
+    m_surface = QImage();
+    m_surfaceBits = nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    m_latest = QImage();
+    m_latestDmabuf = buffer;
+    m_damage = QRect(QPoint(0, 0), buffer->size);
+    publish(VncFrameStats());
+}
+
+void ShmDisplay::addDamage(const QRect &rect, const VncFrameStats &stats)
+{
+    QMutexLocker locker(&m_mutex);
+    m_damage += rect;
+    publish(stats);
+}
+
+void ShmDisplay::publish(const VncFrameStats &stats)
+{
+    /* Called with the mutex held. The frame is whatever has changed since
+     * the GUI latched the previous one. */
+    if (!m_framePending) {
+        m_pendingStats = VncFrameStats();
+        m_pendingStats.readableAt = stats.readableAt ?
+            stats.readableAt : VncStats::timestamp();
+    }
+    m_pendingStats.bytes += stats.bytes;
+    m_pendingStats.decodeTime += stats.decodeTime;
+    m_pendingStats.rects++;
+
+    if (m_framePending) return;
+    m_framePending = true;
+    if (m_updatesWanted) Q_EMIT frameReady();
+}
+
+bool ShmDisplay::swapFrontBuffer()
+{
+    GDBusMethodInvocation *update;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_framePending || !m_updatesWanted) return false;
+        m_front = m_latest;
+        m_frontDmabuf = m_latestDmabuf;
+        m_frontDamage = m_damage;
+        m_frontStats = m_pendingStats;
+        m_damage = QRegion();
+        m_pendingStats = VncFrameStats();
+        m_framePending = false;
+        update = m_pendingDmabufUpdate;
+        m_pendingDmabufUpdate = nullptr;
+    }
+    if (update) g_dbus_method_invocation_return_value(update, nullptr);
+    return true;
+}
+
+void ShmDisplay::setUpdatesWanted(bool wanted)
+{
+    GDBusMethodInvocation *update = nullptr;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (wanted == m_updatesWanted) return;
+        m_updatesWanted = wanted;
+        if (wanted && m_framePending) Q_EMIT frameReady();
+        /* Nobody is going to latch it: don't hold the guest back */
+        if (!wanted) {
+            update = m_pendingDmabufUpdate;
+            m_pendingDmabufUpdate = nullptr;
+        }
+    }
+    if (update) g_dbus_method_invocation_return_value(update, nullptr);
+}
+
+void ShmDisplay::callConsole(const char *interfaceName,
+                             const char *methodName, GVariant *parameters)
+{
+    if (!m_connection) {
+        g_variant_unref(g_variant_ref_sink(parameters));
+        return;
+    }
+    /* Input is never waited for */
+    g_dbus_connection_call(m_connection, nullptr, consolePath, interfaceName,
+                           methodName, parameters, nullptr,
+                           G_DBUS_CALL_FLAGS_NONE, callTimeout,
+                           nullptr, nullptr, nullptr);
+}
+
+void ShmDisplay::requestDesktopSize(const QSize &size)
+{
+    if (size.isEmpty()) return;
+    callConsole("org.qemu.Display1.Console", "SetUIInfo",
+                g_variant_new("(qqiiuu)", 0, 0, 0, 0,
+                              guint32(size.width()), guint32(size.height())));
+}
+
+void ShmDisplay::sendKey(uint32_t qnum, bool pressed)
+{
+    callConsole("org.qemu.Display1.Keyboard", pressed ? "Press" : "Release",
+                g_variant_new("(u)", qnum));
+}
+
+void ShmDisplay::sendKeyEvent(uint32_t keysym, bool pressed)
+{
+    bool shift;
+    const uint32_t qnum = keysymToQnum(keysym, &shift);
+    if (Q_UNLIKELY(!qnum)) {
+        qWarning() << "No scancode for keysym" << QString::number(keysym, 16);
+        return;
+    }
+    if (shift && pressed) sendKey(qnumShift, true);
+    sendKey(qnum, pressed);
+    if (shift && !pressed) sendKey(qnumShift, false);
+}
+
+void ShmDisplay::sendPointerEvent(const VncPointerEvent &event)
+{
+    callConsole("org.qemu.Display1.Mouse", "SetAbsPosition",
+                g_variant_new("(uu)", guint32(qMax(event.x, 0)),
+                              guint32(qMax(event.y, 0))));
+
+    /* Same mapping as VncClientPrivate::qtToRfb() */
+    static const struct {
+        int mask;
+        guint32 button;
+    } buttons[] = {
+        { rfbButton1Mask, ButtonLeft },
+        { rfbButton2Mask, ButtonRight },
+        { rfbButton3Mask, ButtonMiddle },
+    };
+    const int changed = event.buttonMask ^ m_lastButtonMask;
+    for (const auto &b: buttons) {
+        if (!(changed & b.mask)) continue;
+        callConsole("org.qemu.Display1.Mouse",
+                    (event.buttonMask & b.mask) ? "Press" : "Release",
+                    g_variant_new("(u)", b.button));
+    }
+    m_lastButtonMask = event.buttonMask;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_SHM_DISPLAY_H
+#define LOMIRIVNC_SHM_DISPLAY_H
+
+#include "vnc_stats.h"
+
+#include <QImage>
+#include <QMutex>
+#include <QPoint>
+#include <QRegion>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include <QThread>
+#include <cstdint>
+#include <functional>
+
+typedef struct _GAsyncResult GAsyncResult;
+typedef struct _GCancellable GCancellable;
+typedef struct _GDBusConnection GDBusConnection;
+typedef struct _GDBusMethodInvocation GDBusMethodInvocation;
+typedef struct _GError GError;
+typedef struct _GMainContext GMainContext;
+typedef struct _GMainLoop GMainLoop;
+typedef struct _GObject GObject;
+typedef struct _GVariant GVariant;
+
+namespace LomiriVNC {
+
+struct DmabufBuffer;
+struct VncPointerEvent;
+
+/* A local display transport, for a QEMU running on the same device: instead
+ * of having the framebuffer encoded by the VNC server and decoded again,
+ * the display surface of QEMU is mapped into our address space, and only
+ * the damage notifications (and the input events, in the other direction)
+ * travel over a socket.
+ *
+ * This uses the D-Bus display of QEMU (`-display dbus,p2p=yes`): the peer
+ * to peer connection is obtained through a QMP monitor, and we register
+ * ourselves as a display listener implementing the Unix.Map interface, so
+ * that QEMU hands us the memfd of the surface. QEMU versions (or display
+ * devices) which cannot share the surface send the pixels over the socket
+ * instead, which still saves the encoding. With `gl=es`, the guest scanout
+ * is exported by the GPU as a dmabuf instead, which the viewers import as a
+ * texture (see DmabufTexture); QEMU then waits for each frame to be latched
+ * before rendering the next one. The cursor is not part of the surface: it
+ * is defined separately, and reported through cursorChanged().
+ *
+ * The surface is shared, not copied: the image returned by frontImage()
+ * is the memory QEMU draws into, and it might be read while being
+ * updated. The handshake and the D-Bus messages are handled in the thread
+ * owned by this object; connectToDisplay() and the front*() getters are
+ * for the GUI thread, and the input methods can be called from any thread
+ * once the connection has been reported.
+ */
+class ShmDisplay: public QThread
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<void(bool ok)> Callback;
+
+    ShmDisplay();
+    ~ShmDisplay();
+
+    /* Connects through the QMP monitor listening at `qmpSocket`. Returns
+     * immediately; `callback` is invoked in the GUI thread when done,
+     * unless disconnect() is called first, which also interrupts the
+     * handshake. */
+    void connectToDisplay(const QString &qmpSocket, const Callback &callback);
+    void disconnect();
+    bool isConnected() const { return m_connection != nullptr; }
+
+    /* While not wanted, the damage is accumulated but frameReady() is not
+     * emitted */
+    void setUpdatesWanted(bool wanted);
+    void requestDesktopSize(const QSize &size);
+
+    /* `keysym` is an X keysym, as for VNC; it is translated to a scancode
+     * assuming a US keyboard layout in the guest */
+    void sendKeyEvent(uint32_t keysym, bool pressed);
+    void sendPointerEvent(const VncPointerEvent &event);
+
+    bool swapFrontBuffer();
+    const QImage &frontImage() const { return m_front; }
+    /* Set instead of the image when the scanout is a dmabuf */
+    QSharedPointer<const DmabufBuffer> frontDmabuf() const {
+        return m_frontDmabuf;
+    }
+    const QRegion &frontDamage() const { return m_frontDamage; }
+    const VncFrameStats &frontStats() const { return m_frontStats; }
+
+Q_SIGNALS:
+    void frameReady();
+    void disconnected();
+    /* As VncWorker::cursorChanged() */
+    void cursorChanged(const QImage &image, const QPoint &hotspot);
+
+protected:
+    void run() override;
+
+private:
+    static void handleMethodCall(GDBusConnection *connection,
+                                 const char *sender, const char *objectPath,
+                                 const char *interfaceName,
+                                 const char *methodName,
+                                 GVariant *parameters,
+                                 GDBusMethodInvocation *invocation,
+                                 void *userData);
+    static GVariant *getProperty(GDBusConnection *connection,
+                                 const char *sender, const char *objectPath,
+                                 const char *interfaceName,
+                                 const char *propertyName,
+                                 GError **error, void *userData);
+    static void onConnectionClosed(GDBusConnection *connection,
+                                   int remotePeerVanished, GError *error,
+                                   void *userData);
+    static void onListenerRegistered(GObject *source, GAsyncResult *result,
+                                     void *userData);
+
+    bool openDisplay();
+    GDBusConnection *openConnection(int fd, bool delayMessages);
+    bool registerListener();
+    void callConsole(const char *interfaceName, const char *methodName,
+                     GVariant *parameters);
+    void sendKey(uint32_t qnum, bool pressed);
+
+    bool onScanout(GVariant *parameters);
+    bool onUpdate(GVariant *parameters);
+    bool onScanoutMap(GVariant *parameters, GDBusMethodInvocation *invocation);
+    bool onScanoutDmabuf(GVariant *parameters,
+                         GDBusMethodInvocation *invocation);
+    void onUpdateDmabuf(GVariant *parameters,
+                        GDBusMethodInvocation *invocation);
+    void setSurface(const QImage &image, const VncFrameStats &stats);
+    void setDmabuf(const QSharedPointer<const DmabufBuffer> &buffer);
+    void onCursorDefine(GVariant *parameters);
+    void onMouseSet(GVariant *parameters);
+    void addDamage(const QRect &rect, const VncFrameStats &stats);
+    void publish(const VncFrameStats &stats);
+
+private:
+    GMainContext *m_context;
+    GMainLoop *m_loop;
+    /* Set before the thread starts, and cleared once it has finished */
+    QString m_qmpSocket;
+    Callback m_callback;
+    GCancellable *m_cancellable;
+    int m_attempt; // drops the results of interrupted handshakes
+    GDBusConnection *m_connection;
+    GDBusConnection *m_listenerConnection;
+    unsigned m_registrations[2];
+    bool m_closing;
+    /* Owned by the D-Bus thread */
+    QImage m_surface;
+    uchar *m_surfaceBits; // only for surfaces we allocated
+    QImage m_cursor;
+    QPoint m_cursorHotspot;
+    bool m_cursorVisible;
+    /* Shared, protected by the mutex */
+    QMutex m_mutex;
+    QImage m_latest;
+    QSharedPointer<const DmabufBuffer> m_latestDmabuf;
+    GDBusMethodInvocation *m_pendingDmabufUpdate; // answered once latched
+    QRegion m_damage;
+    VncFrameStats m_pendingStats;
+    bool m_framePending;
+    bool m_updatesWanted;
+    /* Owned by the GUI thread */
+    QImage m_front;
+    QSharedPointer<const DmabufBuffer> m_frontDmabuf;
+    QRegion m_frontDamage;
+    VncFrameStats m_frontStats;
+    int m_lastButtonMask;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_SHM_DISPLAY_H
@@ -32,6 +32,7 @@
 #include <sys/sysinfo.h>
 
 #include "vmmanager.h"
+#include "cpu_topology.h"
 
 const QString KEY_STORAGE = QStringLiteral("storage");
 const QString KEY_DESC = QStringLiteral("description");
@@ -46,6 +47,11 @@ const QString KEY_ENABLEFILESHARING = QStringLiteral("enableFileSharing");
 const QString KEY_VIRGLRENDERER = QStringLiteral("useVirglrenderer");
 const QString KEY_EXTERNAL_WINDOW_ONLY = QStringLiteral("externalWindowOnly");
 const QString KEY_ENABLE_VIRTUALIZATION = QStringLiteral("enableVirtualization");
+const QString KEY_SHARED_MEMORY_DISPLAY = QStringLiteral("sharedMemoryDisplay");
+const QString KEY_SUSPEND_ON_STOP = QStringLiteral("suspendOnStop");
+const QString KEY_PAUSE_POLICY = QStringLiteral("pausePolicy");
+const QString KEY_AUTO_BALLOON = QStringLiteral("autoBalloon");
+const QString KEY_CPU_PLACEMENT = QStringLiteral("cpuPlacement");
 
 const QStringList VALID_ARCHES = {
     QStringLiteral("x86_64"),
@@ -114,6 +120,11 @@ Machine* VMManager::fromQml(const QVariantMap& vm)
     machine->enableFileSharing = vm.value(KEY_ENABLEFILESHARING).toBool();
     machine->externalWindowOnly = vm.value(KEY_EXTERNAL_WINDOW_ONLY).toBool();
     machine->enableVirtualization = vm.value(KEY_ENABLE_VIRTUALIZATION).toBool();
+    machine->sharedMemoryDisplay = vm.value(KEY_SHARED_MEMORY_DISPLAY).toBool();
+    machine->suspendOnStop = vm.value(KEY_SUSPEND_ON_STOP).toBool();
+    machine->pausePolicy = vm.value(KEY_PAUSE_POLICY).toInt();
+    machine->autoBalloon = vm.value(KEY_AUTO_BALLOON).toBool();
+    machine->cpuPlacement = vm.value(KEY_CPU_PLACEMENT).toInt();
 
     return machine;
 }
@@ -219,6 +230,7 @@ bool VMManager::resetEFIFirmware(Machine* machine)
     }
 
     machine->flash1 = efiFwTarget;
+    machine->discardSavedState();
     return true;
 }
 
@@ -244,6 +256,7 @@ bool VMManager::resetEFINVRAM(Machine* machine)
     }
 
     machine->flash2 = efiVarsTarget;
+    machine->discardSavedState();
     return true;
 }
 
@@ -331,6 +344,31 @@ QVariantMap VMManager::listEntryForJSON(const QString& path, const QString& stor
     else
         ret.insert(KEY_ENABLE_VIRTUALIZATION, true);
 
+    if (rootObject.contains(KEY_SHARED_MEMORY_DISPLAY))
+        ret.insert(KEY_SHARED_MEMORY_DISPLAY, rootObject.value(KEY_SHARED_MEMORY_DISPLAY).toBool());
+    else
+        ret.insert(KEY_SHARED_MEMORY_DISPLAY, false);
+
+    if (rootObject.contains(KEY_SUSPEND_ON_STOP))
+        ret.insert(KEY_SUSPEND_ON_STOP, rootObject.value(KEY_SUSPEND_ON_STOP).toBool());
+    else
+        ret.insert(KEY_SUSPEND_ON_STOP, false);
+
+    if (rootObject.contains(KEY_PAUSE_POLICY))
+        ret.insert(KEY_PAUSE_POLICY, rootObject.value(KEY_PAUSE_POLICY).toInt());
+    else
+        ret.insert(KEY_PAUSE_POLICY, Machine::PauseNever);
+
+    if (rootObject.contains(KEY_AUTO_BALLOON))
+        ret.insert(KEY_AUTO_BALLOON, rootObject.value(KEY_AUTO_BALLOON).toBool());
+    else
+        ret.insert(KEY_AUTO_BALLOON, false);
+
+    if (rootObject.contains(KEY_CPU_PLACEMENT))
+        ret.insert(KEY_CPU_PLACEMENT, rootObject.value(KEY_CPU_PLACEMENT).toInt());
+    else
+        ret.insert(KEY_CPU_PLACEMENT, Machine::PlaceAnywhere);
+
     return ret;
 }
 
@@ -349,6 +387,11 @@ QByteArray VMManager::machineToJSON(const Machine* machine)
     rootObject.insert(KEY_ENABLEFILESHARING, QJsonValue(machine->enableFileSharing));
     rootObject.insert(KEY_EXTERNAL_WINDOW_ONLY, QJsonValue(machine->externalWindowOnly));
     rootObject.insert(KEY_ENABLE_VIRTUALIZATION, QJsonValue(machine->enableVirtualization));
+    rootObject.insert(KEY_SHARED_MEMORY_DISPLAY, QJsonValue(machine->sharedMemoryDisplay));
+    rootObject.insert(KEY_SUSPEND_ON_STOP, QJsonValue(machine->suspendOnStop));
+    rootObject.insert(KEY_PAUSE_POLICY, QJsonValue(machine->pausePolicy));
+    rootObject.insert(KEY_AUTO_BALLOON, QJsonValue(machine->autoBalloon));
+    rootObject.insert(KEY_CPU_PLACEMENT, QJsonValue(machine->cpuPlacement));
 
     QJsonDocument doc(rootObject);
     return doc.toJson();
@@ -365,11 +408,24 @@ bool VMManager::editVM(Machine* machine)
     {
         const QString jsonFilePath = QStringLiteral("%1/info.json").arg(machine->storage);
         QFile jsonFile(jsonFilePath);
-        if (!jsonFile.open(QFile::ReadWrite | QFile::Truncate)) {
+        if (!jsonFile.open(QFile::ReadWrite)) {
             qWarning() << "Failed to open JSON file for writing";
             return false;
         }
 
+        // A saved state doesn't fit the changed hardware anymore,
+        // while renaming or changing the runtime policies doesn't matter
+        QJsonObject oldObject = QJsonDocument::fromJson(jsonFile.readAll()).object();
+        QJsonObject newObject = QJsonDocument::fromJson(machineToJSON(machine)).object();
+        for (const QString& key : {KEY_DESC, KEY_SUSPEND_ON_STOP, KEY_PAUSE_POLICY, KEY_AUTO_BALLOON, KEY_CPU_PLACEMENT}) {
+            oldObject.remove(key);
+            newObject.remove(key);
+        }
+        if (oldObject != newObject)
+            machine->discardSavedState();
+
+        jsonFile.resize(0);
+        jsonFile.seek(0);
         jsonFile.write(machineToJSON(machine));
     }
     return true;
@@ -422,6 +478,16 @@ int VMManager::maxCores()
     return sysconf(_SC_NPROCESSORS_CONF) - 1;
 }
 
+int VMManager::performanceCores()
+{
+    return CpuTopology::performanceCores().size();
+}
+
+int VMManager::efficiencyCores()
+{
+    return CpuTopology::efficiencyCores().size();
+}
+
 int VMManager::maxHddSize()
 {
     const auto path = appDataLocation();
@@ -32,6 +32,8 @@ class VMManager: public QObject {
 
     Q_PROPERTY(int maxRam READ maxRam CONSTANT)
     Q_PROPERTY(int maxCores READ maxCores CONSTANT)
+    Q_PROPERTY(int performanceCores READ performanceCores CONSTANT)
+    Q_PROPERTY(int efficiencyCores READ efficiencyCores CONSTANT)
     Q_PROPERTY(int maxHddSize READ maxHddSize CONSTANT)
 
 public:
@@ -56,6 +58,8 @@ private:
 
     static int maxRam();
     static int maxCores();
+    static int performanceCores();
+    static int efficiencyCores();
     static int maxHddSize();
 
     QVariantList m_vms;
@@ -19,18 +19,31 @@
 
 #include "vnc_client.h"
 
-#include <QByteArrayList>
+#include "dmabuf_texture.h"
+#include "path_watcher.h"
+#include "shm_display.h"
+#include "vnc_relay.h"
+#include "vnc_worker.h"
+
+#include <QClipboard>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
 #include <QImage>
 #include <QKeyEvent>
 #include <QList>
 #include <QMouseEvent>
+#include <QPoint>
 #include <QPointF>
 #include <QQuickItem>
+#include <QRegion>
 #include <QScopedPointer>
-#include <QSocketNotifier>
-#define XK_CYRILLIC
-#include <rfb/rfbclient.h>
+#include <QSet>
+#include <QSize>
+#include <QThread>
+#include <QTimer>
+#include <cstring>
 
 using namespace LomiriVNC;
 
@@ -43,101 +56,196 @@ public:
     VncClientPrivate(VncClient *q);
     ~VncClientPrivate();
 
-    static void *dataTag();
-    static void vncLog(const char *format, ...);
-    static void vncError(const char *format, ...);
-    static void gotFrameBufferUpdate(rfbClient *cl,
-                                     int x, int y, int w, int h);
-    static char *GetPassword(rfbClient *cl);
-    static rfbBool mallocFrameBuffer(rfbClient* client);
-
     static int qtToRfb(Qt::MouseButtons buttons);
-    static uint32_t qCharToVnc(QChar c);
+    static uint32_t qCharToVnc(uint unicode);
     static uint32_t qKeyToVnc(int key);
+    static bool needsShift(uint32_t keysym);
 
-    void onUpdate(int x, int y, int w, int h);
-    void onResize();
-    char *getPassword();
+    template <typename Func> void postToWorker(Func function);
 
-    bool connectToServer(const QString &host, const QString &password);
+    void connectToServer(const QString &host, const QString &password);
+    void connectToDisplay(const QString &qmpSocket);
+    void connectWhenReady(const QString &host, const QString &password,
+                          const QString &qmpSocket);
+    void attemptConnection();
+    void attemptVnc();
+    void connectDisplay(const QString &qmpSocket);
+    void onDisplayFinished(bool ok);
+    void onAttemptFinished(bool ok);
+    void scheduleAttempt();
+    void cancelAttempts();
+    bool replay(const QString &fileName, bool realTime);
+    QString relayTarget(const QString &host);
+    void connectWorker(const QString &host, const QString &password);
+    void disconnectWorker();
     void disconnect();
+    void stopRelay();
 
-    void onSocketActivated();
+    void onFrameReady();
+    void latchFrame();
+    void onWorkerDisconnected();
+    void updateEncodingSettings();
+    void updateViewersVisibility();
+    void setConnectionState(VncClient::ConnectionState state);
+    void setCursor(const QImage &image, const QPoint &hotspot);
 
-    void sendKeyEvent(QChar c);
+    void sendText(const QString &text);
     void sendKeyEvent(QKeyEvent *keyEvent, bool pressed);
     void sendKeyEvent(uint32_t code, bool pressed);
+    void syncModifiers(Qt::KeyboardModifiers modifiers, uint32_t except);
+    void releaseKeys();
+    void flushKeyEvents();
+    void pasteText(const QString &text);
+    void pasteStep();
+    void cancelPaste();
     void sendMouseEvent(const QPointF &pos, Qt::MouseButtons buttons);
+    void sendPointerEvent(const VncPointerEvent &event);
+    void flushPointerEvent();
 
 private:
-    QScopedPointer<QSocketNotifier> m_notifier;
-    int m_bytesPerPixel;
-    QImage m_image;
+    QThread m_thread;
+    VncWorker *m_worker;
+    ShmDisplay m_display;
+    bool m_usingDisplay; // the shared memory display instead of the worker
+    bool m_connected;
+    VncClient::ConnectionState m_connectionState;
+    /* The target of connectWhenReady() */
+    QString m_pendingHost;
+    QString m_pendingPassword;
+    QString m_pendingDisplay;
+    PathWatcher m_pathWatcher;
+    QTimer m_retryTimer;
+    int m_retryDelay; // ms
+    int m_attempt; // identifies the handshake running in the worker
+    VncEncodingSettings m_encodingSettings;
+    QString m_activeEncodings;
+    int m_maxFps;
+    bool m_continuousUpdates;
+    qreal m_roundTripTime;
+    bool m_viewersVisible;
+    VncStats *m_stats;
+    QString m_recordFile;
+    QScopedPointer<VncRelay> m_relay;
+    QElapsedTimer m_replayTimer;
+    /* Pointer motion is coalesced, and sent at most once per display frame;
+     * button changes are sent immediately */
+    QTimer m_pointerTimer;
+    VncPointerEvent m_pendingPointerEvent;
+    int m_lastButtonMask;
+    /* Key events are sent in one go when control returns to the event
+     * loop; pressed keys are tracked, to keep the modifiers in sync */
+    QVector<VncKeyEvent> m_pendingKeyEvents;
+    QSet<uint32_t> m_pressedKeys;
+    /* Text being pasted, at m_pasteRate characters per second */
+    QString m_pasteBuffer;
+    int m_pasteRate;
+    qreal m_pasteCredit; // characters which may be sent
+    QTimer m_pasteTimer;
+    QElapsedTimer m_pasteClock;
+    quint64 m_pointerEventsReceived;
+    quint64 m_pointerEventsSent;
     QList<QQuickItem*> m_viewers;
-    QString m_password;
-    rfbClient *m_client;
+    QImage m_cursor;
+    QPoint m_cursorHotspot;
     VncClient *q_ptr;
 };
 
 } // namespace
 
 VncClientPrivate::VncClientPrivate(VncClient *q):
-    m_bytesPerPixel(4),
-    m_client(nullptr),
+    m_worker(new VncWorker),
+    m_usingDisplay(false),
+    m_connected(false),
+    m_connectionState(VncClient::Disconnected),
+    m_retryDelay(0),
+    m_attempt(0),
+    m_maxFps(0),
+    m_continuousUpdates(false),
+    m_roundTripTime(-1),
+    m_viewersVisible(true),
+    m_stats(new VncStats(q)),
+    m_lastButtonMask(0),
+    m_pasteRate(60),
+    m_pasteCredit(0),
+    m_pointerEventsReceived(0),
+    m_pointerEventsSent(0),
     q_ptr(q)
 {
-    rfbClientLog = vncLog;
-    rfbClientErr = vncError;
-}
-
-VncClientPrivate::~VncClientPrivate()
-{
-    disconnect();
-}
-
-void *VncClientPrivate::dataTag()
-{
-    return reinterpret_cast<void*>(dataTag);
-}
-
-void VncClientPrivate::vncLog(const char *format, ...)
-{
-    va_list args;
-	va_start(args, format);
-    QString message = QString::vasprintf(format, args);
-	va_end(args);
+    m_thread.setObjectName("VNC I/O");
+    m_worker->moveToThread(&m_thread);
+    QObject::connect(m_worker, &VncWorker::frameReady,
+                     q, [this]() { onFrameReady(); }, Qt::QueuedConnection);
+    QObject::connect(m_worker, &VncWorker::disconnected,
+                     q, [this]() { onWorkerDisconnected(); },
+                     Qt::QueuedConnection);
+    QObject::connect(m_worker, &VncWorker::activeEncodingsChanged,
+                     q, [this, q](const QString &encodings) {
+        m_activeEncodings = encodings;
+        Q_EMIT q->activeEncodingsChanged();
+    }, Qt::QueuedConnection);
+    QObject::connect(m_worker, &VncWorker::continuousUpdatesChanged,
+                     q, [this, q](bool active) {
+        m_continuousUpdates = active;
+        Q_EMIT q->continuousUpdatesChanged();
+    }, Qt::QueuedConnection);
+    QObject::connect(m_worker, &VncWorker::roundTripTimeMeasured,
+                     q, [this, q](qint64 usecs) {
+        m_roundTripTime = usecs / 1000.0;
+        Q_EMIT q->roundTripTimeChanged();
+    }, Qt::QueuedConnection);
+    QObject::connect(m_worker, &VncWorker::cursorChanged,
+                     q, [this](const QImage &image, const QPoint &hotspot) {
+        setCursor(image, hotspot);
+    }, Qt::QueuedConnection);
+    m_thread.start();
 
-    qDebug() << "VNC:" << message.trimmed();
-}
+    QObject::connect(&m_display, &ShmDisplay::frameReady,
+                     q, [this]() { onFrameReady(); }, Qt::QueuedConnection);
+    QObject::connect(&m_display, &ShmDisplay::disconnected,
+                     q, [this]() {
+        if (!m_usingDisplay) return;
+        m_display.disconnect();
+        m_usingDisplay = false;
+        onWorkerDisconnected();
+    }, Qt::QueuedConnection);
+    QObject::connect(&m_display, &ShmDisplay::cursorChanged,
+                     q, [this](const QImage &image, const QPoint &hotspot) {
+        if (m_usingDisplay) setCursor(image, hotspot);
+    }, Qt::QueuedConnection);
 
-void VncClientPrivate::vncError(const char *format, ...)
-{
-    va_list args;
-	va_start(args, format);
-    QString message = QString::vasprintf(format, args);
-	va_end(args);
+    m_retryTimer.setSingleShot(true);
+    QObject::connect(&m_retryTimer, &QTimer::timeout,
+                     q, [this]() { attemptConnection(); });
+    QObject::connect(&m_pathWatcher, &PathWatcher::created,
+                     q, [this]() {
+        if (m_connectionState != VncClient::WaitingForServer) return;
+        m_retryTimer.stop();
+        attemptConnection();
+    });
 
-    qWarning() << "VNC:" << message.trimmed();
-}
+    m_pasteTimer.setInterval(16);
+    QObject::connect(&m_pasteTimer, &QTimer::timeout,
+                     q, [this]() { pasteStep(); });
 
-void VncClientPrivate::gotFrameBufferUpdate(rfbClient *client,
-                                            int x, int y, int w, int h)
-{
-    void *ptr = rfbClientGetClientData(client, dataTag());
-    static_cast<VncClientPrivate*>(ptr)->onUpdate(x, y, w, h);
+    m_pointerTimer.setSingleShot(true);
+    m_pointerTimer.setInterval(16);
+    QObject::connect(&m_pointerTimer, &QTimer::timeout,
+                     q, [this]() { flushPointerEvent(); });
 }
 
-char *VncClientPrivate::GetPassword(rfbClient *client)
+VncClientPrivate::~VncClientPrivate()
 {
-    void *ptr = rfbClientGetClientData(client, dataTag());
-    return static_cast<VncClientPrivate*>(ptr)->getPassword();
+    disconnect();
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
 }
 
-rfbBool VncClientPrivate::mallocFrameBuffer(rfbClient* client)
+template <typename Func>
+void VncClientPrivate::postToWorker(Func function)
 {
-    void *ptr = rfbClientGetClientData(client, dataTag());
-    static_cast<VncClientPrivate*>(ptr)->onResize();
-    return true;
+    /* Never wait for the worker: it might be busy decoding a large update */
+    QMetaObject::invokeMethod(m_worker, function, Qt::QueuedConnection);
 }
 
 int VncClientPrivate::qtToRfb(Qt::MouseButtons buttons)
@@ -151,25 +259,36 @@ int VncClientPrivate::qtToRfb(Qt::MouseButtons buttons)
 
 #include "key_mapping.h"
 
-uint32_t VncClientPrivate::qCharToVnc(QChar c)
+uint32_t VncClientPrivate::qCharToVnc(uint unicode)
 {
-    uint32_t code = 0;
+    switch (unicode) {
+    case '\n': return XK_Return;
+    case '\t': return XK_Tab;
+    case '\b': return XK_BackSpace;
+    case '\r': return 0; // part of a line break
+    }
 
-    if (char latin1 = c.toLatin1()) {
-        code = XK_a + latin1 - 'a';
+    /* Latin-1 keysyms match the code points */
+    if ((unicode >= 0x20 && unicode < 0x7f) ||
+        (unicode >= 0xa0 && unicode <= 0xff)) {
+        return unicode;
     }
+    if (unicode < 0xa0) return 0; // control characters
 
-    if (code == 0) {
-        uint16_t unicode = c.unicode();
-        for (UnicodeKeyEntry *i = unicodeToX11; i->unicode != 0; i++) {
-            if (i->unicode == unicode) {
-                code = i->xKey;
-                break;
-            }
-        }
-        qDebug() << "char" << c << "unicode" << code;
+    for (UnicodeKeyEntry *i = unicodeToX11; i->unicode != 0; i++) {
+        if (i->unicode == unicode) return i->xKey;
     }
-    return code;
+    /* The generic Unicode keysyms */
+    return 0x01000000 | unicode;
+}
+
+/* For the symbols of a US keyboard layout, which the server maps to the
+ * key producing them, but not to the modifier */
+bool VncClientPrivate::needsShift(uint32_t keysym)
+{
+    static const char shifted[] = "~!@#$%^&*()_+{}|:\"<>?";
+    if (keysym >= XK_A && keysym <= XK_Z) return true;
+    return keysym < 0x7f && keysym != 0 && strchr(shifted, int(keysym));
 }
 
 uint32_t VncClientPrivate::qKeyToVnc(int key)
@@ -236,152 +355,618 @@ uint32_t VncClientPrivate::qKeyToVnc(int key)
         case 32: code = XK_KP_Space; break;
 
         default:
-            qWarning() << "Unsupported key:" << key;
+            break; // see sendKeyEvent()
         }
     }
     return code;
 }
 
-void VncClientPrivate::onUpdate(int x, int y, int w, int h)
+void VncClientPrivate::connectToServer(const QString &host,
+                                       const QString &password)
 {
-    Q_UNUSED(x);
-    Q_UNUSED(y);
-    Q_UNUSED(w);
-    Q_UNUSED(h);
+    Q_Q(VncClient);
 
-    for (QQuickItem *viewer: m_viewers) {
-        // TODO: update only the changed area
-        viewer->update();
+    cancelAttempts();
+    disconnectWorker();
+    stopRelay();
+    if (m_connected) {
+        m_connected = false;
+        Q_EMIT q->connectionStatusChanged();
     }
+
+    connectWorker(relayTarget(host), password);
 }
 
-void VncClientPrivate::onResize()
+void VncClientPrivate::connectToDisplay(const QString &qmpSocket)
 {
-    int width = m_client->width;
-    int height = m_client->height;
-    qDebug() << Q_FUNC_INFO << width << height;
+    Q_Q(VncClient);
+
+    cancelAttempts();
+    disconnectWorker();
+    stopRelay();
+    if (m_connected) {
+        m_connected = false;
+        Q_EMIT q->connectionStatusChanged();
+    }
 
-    m_client->updateRect.x = m_client->updateRect.y = 0;
-    m_client->updateRect.w = width;
-    m_client->updateRect.h = height;
+    connectDisplay(qmpSocket);
+}
 
-    m_image = QImage(m_client->width, m_client->height, QImage::Format_RGB32);
-    m_client->frameBuffer = m_image.bits();
-    m_client->width = m_image.bytesPerLine() / m_bytesPerPixel;
-    m_client->format.bitsPerPixel = m_image.depth();
-    m_client->format.redShift=16;
-    m_client->format.greenShift=8;
-    m_client->format.blueShift=0;
-    m_client->format.redMax=0xff;
-    m_client->format.greenMax=0xff;
-    m_client->format.blueMax=0xff;
-    m_client->canHandleNewFBSize=true;
-    bool ok = SetFormatAndEncodings(m_client);
-    if (Q_UNLIKELY(!ok)) {
-        qWarning() << "Could not set format to server";
+void VncClientPrivate::connectWhenReady(const QString &host,
+                                        const QString &password,
+                                        const QString &qmpSocket)
+{
+    Q_Q(VncClient);
+
+    cancelAttempts();
+    disconnectWorker();
+    stopRelay();
+    if (m_connected) {
+        m_connected = false;
+        Q_EMIT q->connectionStatusChanged();
     }
+
+    m_pendingHost = host;
+    m_pendingPassword = password;
+    m_pendingDisplay = qmpSocket;
+    m_retryDelay = 0;
+
+    /* Only local sockets can be waited for; anything else is just retried */
+    QStringList paths;
+    if (!qmpSocket.isEmpty()) paths.append(qmpSocket);
+    if (host.startsWith(QLatin1Char('/'))) paths.append(host);
+    if (!paths.isEmpty()) m_pathWatcher.watch(paths);
+
+    attemptConnection();
 }
 
-char *VncClientPrivate::getPassword()
+void VncClientPrivate::attemptConnection()
 {
-	return strdup(m_password.toUtf8().constData());
+    /* The shared memory display is preferred, once its socket is there;
+     * VNC is tried if it fails */
+    if (!m_pendingDisplay.isEmpty() && QFile::exists(m_pendingDisplay)) {
+        connectDisplay(m_pendingDisplay);
+        return;
+    }
+    attemptVnc();
 }
 
-bool VncClientPrivate::connectToServer(const QString &host, const QString &password)
+void VncClientPrivate::attemptVnc()
+{
+    const bool local = m_pendingHost.startsWith(QLatin1Char('/'));
+    if (m_pendingHost.isEmpty() ||
+        (local && !QFile::exists(m_pendingHost))) {
+        setConnectionState(VncClient::WaitingForServer);
+        scheduleAttempt();
+        return;
+    }
+
+    connectWorker(relayTarget(m_pendingHost), m_pendingPassword);
+}
+
+/* The QMP and D-Bus handshakes run in the display thread, and the result
+ * comes back to onDisplayFinished() */
+void VncClientPrivate::connectDisplay(const QString &qmpSocket)
+{
+    setConnectionState(VncClient::Connecting);
+    const int attempt = ++m_attempt;
+    m_display.connectToDisplay(qmpSocket, [this, attempt](bool ok) {
+        if (attempt != m_attempt) return;
+        onDisplayFinished(ok);
+    });
+}
+
+void VncClientPrivate::onDisplayFinished(bool ok)
+{
+    if (ok) {
+        m_display.setUpdatesWanted(m_viewersVisible);
+        m_usingDisplay = true;
+        onAttemptFinished(true);
+    } else if (!m_pendingDisplay.isEmpty()) {
+        qDebug() << "Shared memory display not available, trying VNC";
+        attemptVnc();
+    } else {
+        onAttemptFinished(false);
+    }
+}
+
+void VncClientPrivate::onAttemptFinished(bool ok)
 {
     Q_Q(VncClient);
 
-    if (m_client) {
-        disconnect();
+    if (!ok) {
+        m_replayTimer.invalidate();
+        m_relay.reset();
+        /* Only the connections made by connectWhenReady() are retried */
+        if (m_pendingHost.isEmpty() && m_pendingDisplay.isEmpty()) {
+            setConnectionState(VncClient::Disconnected);
+            return;
+        }
+        setConnectionState(VncClient::WaitingForServer);
+        scheduleAttempt();
+        return;
     }
 
-    m_password = QString(password);
+    m_pathWatcher.stop();
+    m_retryDelay = 0;
+    m_connected = true;
+    Q_EMIT q->connectionStatusChanged();
+    setConnectionState(VncClient::Connected);
+}
 
-    m_client = rfbGetClient(8, 3, m_bytesPerPixel);
-    m_client->MallocFrameBuffer = mallocFrameBuffer;
-    m_client->GotFrameBufferUpdate = gotFrameBufferUpdate;
-    m_client->GetPassword = GetPassword;
-    rfbClientSetClientData(m_client, dataTag(), this);
+void VncClientPrivate::scheduleAttempt()
+{
+    /* Exponential backoff: the socket notifications normally make us try
+     * at the right time, this is for the cases they cannot see (the server
+     * not listening yet, or a remote host) */
+    m_retryDelay = qBound(100, m_retryDelay * 2, 5000);
+    m_retryTimer.start(m_retryDelay);
+}
 
-    QByteArrayList arguments = {
-        "lomiri-vnc",
-    };
-    arguments.append(host.toUtf8());
-    int argc = arguments.count();
-    QVector<char *> argv;
-    argv.reserve(argc + 1);
-    for (const QByteArray &a: arguments) {
-        argv.append((char*)a.constData());
-    }
-    argv.append(nullptr);
-
-    bool ok = rfbInitClient(m_client, &argc, argv.data());
-    if (Q_UNLIKELY(!ok)) {
-        qWarning() << "Could not initialize rfbClient";
-        m_client = nullptr;
-        return false;
+void VncClientPrivate::cancelAttempts()
+{
+    m_attempt++;
+    m_retryTimer.stop();
+    m_pathWatcher.stop();
+    m_pendingHost.clear();
+    m_pendingPassword.clear();
+    m_pendingDisplay.clear();
+}
+
+bool VncClientPrivate::replay(const QString &fileName, bool realTime)
+{
+    Q_Q(VncClient);
+
+    VncRelay::Header header;
+    if (!VncRelay::readHeader(fileName, &header)) return false;
+
+    cancelAttempts();
+    disconnectWorker();
+    stopRelay();
+    if (m_connected) {
+        m_connected = false;
+        Q_EMIT q->connectionStatusChanged();
     }
 
-    m_notifier.reset(new QSocketNotifier(m_client->sock,
-                                         QSocketNotifier::Read));
-    QObject::connect(m_notifier.data(), &QSocketNotifier::activated,
-                     q, [this]() { onSocketActivated(); });
-    Q_EMIT q->connectionStatusChanged();
+    /* The recorded data is in the pixel format of the recording client */
+    q->setPixelDepth(header.pixelDepth);
+
+    m_relay.reset(VncRelay::player(fileName, realTime));
+    QString path = m_relay->listen();
+    if (Q_UNLIKELY(path.isEmpty())) {
+        m_relay.reset();
+        return false;
+    }
+    m_stats->reset();
+    m_replayTimer.start();
+    connectWorker(path, QString());
     return true;
 }
 
+void VncClientPrivate::stopRelay()
+{
+    if (!m_relay) return;
+
+    /* At the end of a replay, report how the pipeline performed */
+    if (m_replayTimer.isValid()) {
+        const qreal seconds = qMax(m_replayTimer.elapsed() / 1000.0, 0.001);
+        const QImage &image = m_worker->frontImage();
+        qDebug().nospace() << "Replayed " << m_relay->bytesRelayed() <<
+            " bytes (" << image.width() << "x" << image.height() << ", " <<
+            m_relay->header().pixelDepth << " bpp, encodings \"" <<
+            m_relay->header().encodings << "\") in " << seconds << " s: " <<
+            m_relay->bytesRelayed() / seconds / 1000000 << " MB/s, " <<
+            m_stats->frames() / seconds << " frames/s, decode " <<
+            m_stats->average(VncStats::DecodeTime) << " ms (p95 " <<
+            m_stats->percentile(VncStats::DecodeTime, 95) << "), paint " <<
+            m_stats->average(VncStats::PaintTime) << " ms (p95 " <<
+            m_stats->percentile(VncStats::PaintTime, 95) << ")";
+        m_replayTimer.invalidate();
+    }
+    m_relay.reset();
+}
+
+/* If recording, connections go through the relay */
+QString VncClientPrivate::relayTarget(const QString &host)
+{
+    if (m_recordFile.isEmpty()) return host;
+
+    VncRelay::Header header;
+    header.pixelDepth = m_encodingSettings.pixelDepth;
+    header.encodings = m_encodingSettings.encodings;
+    m_relay.reset(VncRelay::recorder(host, m_recordFile, header));
+    QString path = m_relay->listen();
+    if (Q_UNLIKELY(path.isEmpty())) {
+        qWarning() << "Not recording the session";
+        m_relay.reset();
+        return host;
+    }
+    return path;
+}
+
+/* The RFB handshake runs in the worker thread, and the result comes back
+ * to onAttemptFinished() */
+void VncClientPrivate::connectWorker(const QString &host,
+                                     const QString &password)
+{
+    Q_Q(VncClient);
+
+    setConnectionState(VncClient::Connecting);
+    const int attempt = ++m_attempt;
+    VncWorker *worker = m_worker;
+    postToWorker([this, q, worker, attempt, host, password]() {
+        const bool ok = worker->connectToServer(host, password);
+        QMetaObject::invokeMethod(q, [this, attempt, ok]() {
+            /* Cancelled in the meantime; whoever did that has also
+             * disconnected the worker */
+            if (attempt != m_attempt) return;
+            onAttemptFinished(ok);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void VncClientPrivate::disconnectWorker()
+{
+    m_pointerTimer.stop();
+    m_lastButtonMask = 0;
+    cancelPaste();
+    m_pendingKeyEvents.clear();
+    m_pressedKeys.clear();
+
+    /* This also interrupts a handshake in progress */
+    m_display.disconnect();
+    m_usingDisplay = false;
+
+    /* Don't wait for the worker, which might be in the middle of a
+     * handshake: the disconnection is queued after it, and the result of
+     * the handshake is dropped, since its attempt is not the current one
+     * anymore */
+    m_attempt++;
+    VncWorker *worker = m_worker;
+    postToWorker([worker]() { worker->disconnect(); });
+    setCursor(QImage(), QPoint());
+}
+
 void VncClientPrivate::disconnect()
 {
     Q_Q(VncClient);
 
-    m_notifier.reset();
-    if (m_client) {
-        rfbClientCleanup(m_client);
-        m_client = nullptr;
+    cancelAttempts();
+    disconnectWorker();
+    stopRelay();
+
+    m_connected = false;
+    Q_EMIT q->connectionStatusChanged();
+    setConnectionState(VncClient::Disconnected);
+    if (m_roundTripTime >= 0) {
+        m_roundTripTime = -1;
+        Q_EMIT q->roundTripTimeChanged();
+    }
+}
+
+void VncClientPrivate::onFrameReady()
+{
+    Q_Q(VncClient);
+
+    /* Don't latch the frame yet: the viewers will do that when they are
+     * about to render, so that all the frames decoded in the meantime end
+     * up in a single repaint. */
+    Q_EMIT q->frameAvailable();
+}
+
+void VncClientPrivate::latchFrame()
+{
+    Q_Q(VncClient);
+
+    if (m_usingDisplay) {
+        if (!m_display.swapFrontBuffer()) return;
+        m_stats->addFrame(m_display.frontStats());
+        Q_EMIT q->frameBufferUpdated(m_display.frontDamage());
+        return;
     }
 
+    if (!m_worker->swapFrontBuffer()) return;
+
+    VncWorker *worker = m_worker;
+    postToWorker([worker]() { worker->frameLatched(); });
+
+    m_stats->addFrame(m_worker->frontStats());
+
+    Q_EMIT q->frameBufferUpdated(m_worker->frontDamage());
+}
+
+void VncClientPrivate::onWorkerDisconnected()
+{
+    Q_Q(VncClient);
+
+    if (!m_connected) return;
+    stopRelay();
+    setCursor(QImage(), QPoint());
+    m_connected = false;
     Q_EMIT q->connectionStatusChanged();
+    setConnectionState(VncClient::Disconnected);
+    if (m_roundTripTime >= 0) {
+        m_roundTripTime = -1;
+        Q_EMIT q->roundTripTimeChanged();
+    }
+}
+
+void VncClientPrivate::setConnectionState(VncClient::ConnectionState state)
+{
+    Q_Q(VncClient);
+
+    if (state == m_connectionState) return;
+    m_connectionState = state;
+    Q_EMIT q->connectionStateChanged();
+}
+
+void VncClientPrivate::setCursor(const QImage &image, const QPoint &hotspot)
+{
+    Q_Q(VncClient);
+
+    if (image.isNull() && m_cursor.isNull()) return;
+    m_cursor = image;
+    m_cursorHotspot = hotspot;
+    Q_EMIT q->cursorChanged();
 }
 
-void VncClientPrivate::onSocketActivated()
+void VncClientPrivate::updateEncodingSettings()
 {
-    bool ok = HandleRFBServerMessage(m_client);
-    if (Q_UNLIKELY(!ok)) {
-        qWarning() << "RFB failed to handle message";
+    VncWorker *worker = m_worker;
+    VncEncodingSettings settings = m_encodingSettings;
+    postToWorker([worker, settings]() {
+        worker->setEncodingSettings(settings);
+    });
+}
+
+void VncClientPrivate::updateViewersVisibility()
+{
+    bool visible = false;
+    for (QQuickItem *viewer: m_viewers) {
+        if (viewer->isVisible()) {
+            visible = true;
+            break;
+        }
     }
+    if (visible == m_viewersVisible) return;
+    m_viewersVisible = visible;
+
+    m_display.setUpdatesWanted(visible);
+    VncWorker *worker = m_worker;
+    postToWorker([worker, visible]() { worker->setUpdatesWanted(visible); });
 }
 
-void VncClientPrivate::sendKeyEvent(QChar c)
+void VncClientPrivate::sendText(const QString &text)
 {
-    uint32_t code = qCharToVnc(c);
-    sendKeyEvent(code, true);
-    sendKeyEvent(code, false);
+    if (Q_UNLIKELY(!m_connected)) {
+        qWarning() << "Not connected";
+        return;
+    }
+
+    /* The shared memory display adds the shift key by itself */
+    const bool shiftHeld = m_usingDisplay ||
+        m_pressedKeys.contains(XK_Shift_L) ||
+        m_pressedKeys.contains(XK_Shift_R);
+    for (uint unicode: text.toUcs4()) {
+        const uint32_t code = qCharToVnc(unicode);
+        if (code == 0) continue;
+        const bool shift = !shiftHeld && needsShift(code);
+        if (shift) sendKeyEvent(XK_Shift_L, true);
+        sendKeyEvent(code, true);
+        sendKeyEvent(code, false);
+        if (shift) sendKeyEvent(XK_Shift_L, false);
+    }
 }
 
 void VncClientPrivate::sendKeyEvent(QKeyEvent *keyEvent, bool pressed)
 {
-    // TODO handle modifiers
     uint32_t code = qKeyToVnc(keyEvent->key());
+    if (code == 0) {
+        /* Punctuation and such: go by the character it produces */
+        const QString text = keyEvent->text();
+        if (text.size() == 1 && text.at(0).isPrint()) {
+            code = qCharToVnc(text.at(0).unicode());
+        }
+    }
+    if (code == 0) {
+        qWarning() << "Unsupported key:" << keyEvent->key();
+        return;
+    }
+
+    /* A modifier might have been pressed or released while we didn't have
+     * the focus */
+    syncModifiers(keyEvent->modifiers(), code);
     sendKeyEvent(code, pressed);
 }
 
+void VncClientPrivate::syncModifiers(Qt::KeyboardModifiers modifiers,
+                                     uint32_t except)
+{
+    static const struct {
+        Qt::KeyboardModifier modifier;
+        uint32_t left;
+        uint32_t right;
+    } keys[] = {
+        { Qt::ShiftModifier, XK_Shift_L, XK_Shift_R },
+        { Qt::ControlModifier, XK_Control_L, XK_Control_R },
+        { Qt::AltModifier, XK_Alt_L, XK_Alt_R },
+    };
+    for (const auto &k: keys) {
+        /* The event of the modifier key itself may or may not include it,
+         * depending on the platform */
+        if (except == k.left || except == k.right) continue;
+        const bool held = m_pressedKeys.contains(k.left) ||
+            m_pressedKeys.contains(k.right);
+        if ((modifiers & k.modifier) && !held) {
+            sendKeyEvent(k.left, true);
+        } else if (!(modifiers & k.modifier) && held) {
+            if (m_pressedKeys.contains(k.left)) sendKeyEvent(k.left, false);
+            if (m_pressedKeys.contains(k.right)) sendKeyEvent(k.right, false);
+        }
+    }
+}
+
+void VncClientPrivate::releaseKeys()
+{
+    if (!m_connected) return;
+    const QSet<uint32_t> pressed = m_pressedKeys;
+    for (uint32_t code: pressed) {
+        sendKeyEvent(code, false);
+    }
+}
+
 void VncClientPrivate::sendKeyEvent(uint32_t code, bool pressed)
 {
-    if (Q_UNLIKELY(!m_client)) {
+    Q_Q(VncClient);
+
+    if (Q_UNLIKELY(!m_connected)) {
         qWarning() << "Not connected";
         return;
     }
-    SendKeyEvent(m_client, code, pressed);
+    /* Don't let key events overtake the pointer */
+    flushPointerEvent();
+
+    if (pressed) {
+        m_pressedKeys.insert(code);
+    } else {
+        m_pressedKeys.remove(code);
+    }
+
+    if (m_pendingKeyEvents.isEmpty()) {
+        QMetaObject::invokeMethod(q, [this]() { flushKeyEvents(); },
+                                  Qt::QueuedConnection);
+    }
+    m_pendingKeyEvents.append(VncKeyEvent { code, pressed });
+}
+
+void VncClientPrivate::flushKeyEvents()
+{
+    if (m_pendingKeyEvents.isEmpty()) return;
+    const QVector<VncKeyEvent> events = m_pendingKeyEvents;
+    m_pendingKeyEvents.clear();
+
+    if (m_usingDisplay) {
+        for (const VncKeyEvent &event: events) {
+            m_display.sendKeyEvent(event.keysym, event.pressed);
+        }
+        return;
+    }
+
+    VncWorker *worker = m_worker;
+    postToWorker([worker, events]() {
+        worker->sendKeyEvents(events);
+    });
+}
+
+void VncClientPrivate::pasteText(const QString &text)
+{
+    Q_Q(VncClient);
+
+    if (text.isEmpty()) return;
+    const bool wasPasting = !m_pasteBuffer.isEmpty();
+    m_pasteBuffer += text;
+    if (wasPasting) return;
+
+    m_pasteClock.start();
+    m_pasteCredit = 1; // start right away
+    pasteStep();
+    if (!m_pasteBuffer.isEmpty()) {
+        m_pasteTimer.start();
+        Q_EMIT q->pastingChanged();
+    }
+}
+
+void VncClientPrivate::pasteStep()
+{
+    Q_Q(VncClient);
+
+    /* Guest keyboards have short queues (16 events for the USB one), and
+     * drop the keys that don't fit: stream the text, rather than flooding
+     * them with it */
+    int count = m_pasteBuffer.size();
+    if (m_pasteRate > 0) {
+        m_pasteCredit += m_pasteRate * m_pasteClock.restart() / 1000.0;
+        count = qMin(int(m_pasteCredit), count);
+        m_pasteCredit -= count;
+        /* Never split a surrogate pair */
+        if (count > 0 && count < m_pasteBuffer.size() &&
+            m_pasteBuffer.at(count - 1).isHighSurrogate()) {
+            count++;
+        }
+    }
+    if (count > 0) {
+        sendText(m_pasteBuffer.left(count));
+        m_pasteBuffer.remove(0, count);
+    }
+
+    if (m_pasteBuffer.isEmpty() && m_pasteTimer.isActive()) {
+        m_pasteTimer.stop();
+        Q_EMIT q->pastingChanged();
+    }
+}
+
+void VncClientPrivate::cancelPaste()
+{
+    Q_Q(VncClient);
+
+    if (m_pasteBuffer.isEmpty()) return;
+    m_pasteBuffer.clear();
+    m_pasteTimer.stop();
+    Q_EMIT q->pastingChanged();
 }
 
 void VncClientPrivate::sendMouseEvent(const QPointF &pos,
                                       Qt::MouseButtons buttons)
 {
-    if (Q_UNLIKELY(!m_client)) {
+    if (Q_UNLIKELY(!m_connected)) {
         qWarning() << "Not connected";
         return;
     }
-    SendPointerEvent(m_client, pos.x(), pos.y(), qtToRfb(buttons));
+    Q_Q(VncClient);
+
+    m_pointerEventsReceived++;
+    VncPointerEvent event { int(pos.x()), int(pos.y()), qtToRfb(buttons) };
+    if (event.buttonMask != m_lastButtonMask) {
+        /* The pending motion, if any, is superseded by this event */
+        m_pointerTimer.stop();
+        m_lastButtonMask = event.buttonMask;
+        sendPointerEvent(event);
+    } else {
+        m_pendingPointerEvent = event;
+        if (!m_pointerTimer.isActive()) {
+            m_pointerTimer.start();
+        }
+    }
+    Q_EMIT q->pointerEventCountersChanged();
+}
+
+void VncClientPrivate::flushPointerEvent()
+{
+    if (!m_pointerTimer.isActive()) return;
+    m_pointerTimer.stop();
+    sendPointerEvent(m_pendingPointerEvent);
+}
+
+void VncClientPrivate::sendPointerEvent(const VncPointerEvent &event)
+{
+    Q_Q(VncClient);
+
+    /* Don't let the pointer overtake the keys */
+    flushKeyEvents();
+
+    m_pointerEventsSent++;
+    if (m_usingDisplay) {
+        m_display.sendPointerEvent(event);
+        Q_EMIT q->pointerEventCountersChanged();
+        return;
+    }
+
+    VncWorker *worker = m_worker;
+    QVector<VncPointerEvent> events { event };
+    postToWorker([worker, events]() {
+        worker->sendPointerEvents(events);
+    });
+    Q_EMIT q->pointerEventCountersChanged();
 }
 
 VncClient::VncClient(QObject *parent):
@@ -395,31 +980,249 @@ VncClient::~VncClient() = default;
 bool VncClient::isConnected() const
 {
     Q_D(const VncClient);
-    return d->m_client != nullptr;
+    return d->m_connected;
+}
+
+VncClient::ConnectionState VncClient::connectionState() const
+{
+    Q_D(const VncClient);
+    return d->m_connectionState;
+}
+
+void VncClient::setEncodings(const QString &encodings)
+{
+    Q_D(VncClient);
+    QByteArray latin1 = encodings.simplified().toLatin1();
+    if (latin1 == d->m_encodingSettings.encodings) return;
+    d->m_encodingSettings.encodings = latin1;
+    d->updateEncodingSettings();
+    Q_EMIT encodingsChanged();
+}
+
+QString VncClient::encodings() const
+{
+    Q_D(const VncClient);
+    return QString::fromLatin1(d->m_encodingSettings.encodings);
+}
+
+void VncClient::setCompressLevel(int level)
+{
+    Q_D(VncClient);
+    if (level == d->m_encodingSettings.compressLevel) return;
+    d->m_encodingSettings.compressLevel = level;
+    d->updateEncodingSettings();
+    Q_EMIT compressLevelChanged();
+}
+
+int VncClient::compressLevel() const
+{
+    Q_D(const VncClient);
+    return d->m_encodingSettings.compressLevel;
+}
+
+void VncClient::setQualityLevel(int level)
+{
+    Q_D(VncClient);
+    if (level == d->m_encodingSettings.qualityLevel) return;
+    d->m_encodingSettings.qualityLevel = level;
+    d->updateEncodingSettings();
+    Q_EMIT qualityLevelChanged();
+}
+
+int VncClient::qualityLevel() const
+{
+    Q_D(const VncClient);
+    return d->m_encodingSettings.qualityLevel;
+}
+
+void VncClient::setPixelDepth(int depth)
+{
+    Q_D(VncClient);
+    if (Q_UNLIKELY(depth != 16 && depth != 32)) {
+        qWarning() << "Unsupported pixel depth:" << depth;
+        return;
+    }
+    if (depth == d->m_encodingSettings.pixelDepth) return;
+    d->m_encodingSettings.pixelDepth = depth;
+    d->updateEncodingSettings();
+    Q_EMIT pixelDepthChanged();
+}
+
+int VncClient::pixelDepth() const
+{
+    Q_D(const VncClient);
+    return d->m_encodingSettings.pixelDepth;
+}
+
+void VncClient::setAutomaticEncoding(bool automatic)
+{
+    Q_D(VncClient);
+    if (automatic == d->m_encodingSettings.automatic) return;
+    d->m_encodingSettings.automatic = automatic;
+    d->updateEncodingSettings();
+    Q_EMIT automaticEncodingChanged();
+}
+
+bool VncClient::automaticEncoding() const
+{
+    Q_D(const VncClient);
+    return d->m_encodingSettings.automatic;
+}
+
+QString VncClient::activeEncodings() const
+{
+    Q_D(const VncClient);
+    return d->m_activeEncodings;
+}
+
+void VncClient::setMaxFps(int fps)
+{
+    Q_D(VncClient);
+    fps = qMax(fps, 0);
+    if (fps == d->m_maxFps) return;
+    d->m_maxFps = fps;
+    VncWorker *worker = d->m_worker;
+    d->postToWorker([worker, fps]() { worker->setMaxFps(fps); });
+    Q_EMIT maxFpsChanged();
+}
+
+int VncClient::maxFps() const
+{
+    Q_D(const VncClient);
+    return d->m_maxFps;
+}
+
+quint64 VncClient::pointerEventsReceived() const
+{
+    Q_D(const VncClient);
+    return d->m_pointerEventsReceived;
+}
+
+quint64 VncClient::pointerEventsSent() const
+{
+    Q_D(const VncClient);
+    return d->m_pointerEventsSent;
+}
+
+bool VncClient::continuousUpdates() const
+{
+    Q_D(const VncClient);
+    return d->m_continuousUpdates;
+}
+
+qreal VncClient::roundTripTime() const
+{
+    Q_D(const VncClient);
+    return d->m_roundTripTime;
+}
+
+VncStats *VncClient::stats() const
+{
+    Q_D(const VncClient);
+    return d->m_stats;
+}
+
+const VncFrameStats &VncClient::frameStats() const
+{
+    Q_D(const VncClient);
+    return d->m_usingDisplay ?
+        d->m_display.frontStats() : d->m_worker->frontStats();
 }
 
 void VncClient::addViewer(QQuickItem *viewer)
 {
     Q_D(VncClient);
     d->m_viewers.append(viewer);
+    QObject::connect(viewer, &QQuickItem::visibleChanged,
+                     this, [d]() { d->updateViewersVisibility(); });
+    QObject::connect(viewer, &QObject::destroyed,
+                     this, [this, viewer]() { removeViewer(viewer); });
+    d->updateViewersVisibility();
 }
 
 void VncClient::removeViewer(QQuickItem *viewer)
 {
     Q_D(VncClient);
     d->m_viewers.removeAll(viewer);
+    QObject::disconnect(viewer, nullptr, this, nullptr);
+    d->updateViewersVisibility();
 }
 
 const QImage &VncClient::image() const
 {
     Q_D(const VncClient);
-    return d->m_image;
+    return d->m_usingDisplay ?
+        d->m_display.frontImage() : d->m_worker->frontImage();
+}
+
+const QImage &VncClient::cursorImage() const
+{
+    Q_D(const VncClient);
+    return d->m_cursor;
+}
+
+QPoint VncClient::cursorHotspot() const
+{
+    Q_D(const VncClient);
+    return d->m_cursorHotspot;
+}
+
+QSharedPointer<const DmabufBuffer> VncClient::dmabuf() const
+{
+    Q_D(const VncClient);
+    return d->m_usingDisplay ?
+        d->m_display.frontDmabuf() : QSharedPointer<const DmabufBuffer>();
+}
+
+QSize VncClient::frameSize() const
+{
+    const QSharedPointer<const DmabufBuffer> buffer = dmabuf();
+    return buffer ? buffer->size : image().size();
+}
+
+void VncClient::latchFrame()
+{
+    Q_D(VncClient);
+    d->latchFrame();
+}
+
+void VncClient::setRecordFile(const QString &fileName)
+{
+    Q_D(VncClient);
+    if (fileName == d->m_recordFile) return;
+    d->m_recordFile = fileName;
+    Q_EMIT recordFileChanged();
+}
+
+QString VncClient::recordFile() const
+{
+    Q_D(const VncClient);
+    return d->m_recordFile;
+}
+
+void VncClient::connectToServer(const QString &host, const QString &password)
+{
+    Q_D(VncClient);
+    d->connectToServer(host, password);
 }
 
-bool VncClient::connectToServer(const QString &host, const QString &password)
+void VncClient::connectToDisplay(const QString &qmpSocket)
 {
     Q_D(VncClient);
-    return d->connectToServer(host, password);
+    d->connectToDisplay(qmpSocket);
+}
+
+void VncClient::connectWhenReady(const QString &host, const QString &password,
+                                 const QString &qmpSocket)
+{
+    Q_D(VncClient);
+    d->connectWhenReady(host, password, qmpSocket);
+}
+
+bool VncClient::replay(const QString &fileName, bool realTime)
+{
+    Q_D(VncClient);
+    return d->replay(fileName, realTime);
 }
 
 void VncClient::disconnect()
@@ -428,10 +1231,72 @@ void VncClient::disconnect()
     return d->disconnect();
 }
 
+void VncClient::requestDesktopSize(const QSize &size)
+{
+    Q_D(VncClient);
+    if (d->m_usingDisplay) {
+        d->m_display.requestDesktopSize(size);
+        return;
+    }
+    VncWorker *worker = d->m_worker;
+    d->postToWorker([worker, size]() { worker->requestDesktopSize(size); });
+}
+
 void VncClient::sendKeyEvent(QChar c)
 {
     Q_D(VncClient);
-    return d->sendKeyEvent(c);
+    d->sendText(QString(c));
+}
+
+void VncClient::sendText(const QString &text)
+{
+    Q_D(VncClient);
+    d->sendText(text);
+}
+
+void VncClient::releaseKeys()
+{
+    Q_D(VncClient);
+    d->releaseKeys();
+}
+
+void VncClient::pasteText(const QString &text)
+{
+    Q_D(VncClient);
+    d->pasteText(text);
+}
+
+void VncClient::pasteClipboard()
+{
+    Q_D(VncClient);
+    d->pasteText(QGuiApplication::clipboard()->text());
+}
+
+void VncClient::cancelPaste()
+{
+    Q_D(VncClient);
+    d->cancelPaste();
+}
+
+bool VncClient::isPasting() const
+{
+    Q_D(const VncClient);
+    return !d->m_pasteBuffer.isEmpty();
+}
+
+void VncClient::setPasteRate(int rate)
+{
+    Q_D(VncClient);
+    rate = qMax(rate, 0);
+    if (rate == d->m_pasteRate) return;
+    d->m_pasteRate = rate;
+    Q_EMIT pasteRateChanged();
+}
+
+int VncClient::pasteRate() const
+{
+    Q_D(const VncClient);
+    return d->m_pasteRate;
 }
 
 void VncClient::sendKeyEvent(QKeyEvent *keyEvent, bool pressed)
@@ -20,42 +20,212 @@
 #ifndef LOMIRIVNC_VNC_CLIENT_H
 #define LOMIRIVNC_VNC_CLIENT_H
 
+#include "vnc_stats.h"
+
 #include <QObject>
+#include <QPoint>
 #include <QScopedPointer>
+#include <QSharedPointer>
 
 class QImage;
 class QKeyEvent;
 class QPointF;
 class QQuickItem;
+class QRegion;
+class QSize;
 
 namespace LomiriVNC {
 
+struct DmabufBuffer;
 class VncClientPrivate;
 class VncClient: public QObject
 {
     Q_OBJECT
     Q_PROPERTY(bool connected READ isConnected NOTIFY connectionStatusChanged)
+    Q_PROPERTY(ConnectionState connectionState READ connectionState
+               NOTIFY connectionStateChanged)
+    Q_PROPERTY(QString encodings READ encodings WRITE setEncodings
+               NOTIFY encodingsChanged)
+    Q_PROPERTY(int compressLevel READ compressLevel WRITE setCompressLevel
+               NOTIFY compressLevelChanged)
+    Q_PROPERTY(int qualityLevel READ qualityLevel WRITE setQualityLevel
+               NOTIFY qualityLevelChanged)
+    Q_PROPERTY(int pixelDepth READ pixelDepth WRITE setPixelDepth
+               NOTIFY pixelDepthChanged)
+    Q_PROPERTY(bool automaticEncoding READ automaticEncoding
+               WRITE setAutomaticEncoding NOTIFY automaticEncodingChanged)
+    Q_PROPERTY(QString activeEncodings READ activeEncodings
+               NOTIFY activeEncodingsChanged)
+    Q_PROPERTY(int maxFps READ maxFps WRITE setMaxFps NOTIFY maxFpsChanged)
+    Q_PROPERTY(bool continuousUpdates READ continuousUpdates
+               NOTIFY continuousUpdatesChanged)
+    Q_PROPERTY(qreal roundTripTime READ roundTripTime
+               NOTIFY roundTripTimeChanged)
+    Q_PROPERTY(LomiriVNC::VncStats *stats READ stats CONSTANT)
+    Q_PROPERTY(QString recordFile READ recordFile WRITE setRecordFile
+               NOTIFY recordFileChanged)
+    Q_PROPERTY(bool pasting READ isPasting NOTIFY pastingChanged)
+    Q_PROPERTY(int pasteRate READ pasteRate WRITE setPasteRate
+               NOTIFY pasteRateChanged)
+    Q_PROPERTY(quint64 pointerEventsReceived READ pointerEventsReceived
+               NOTIFY pointerEventCountersChanged)
+    Q_PROPERTY(quint64 pointerEventsSent READ pointerEventsSent
+               NOTIFY pointerEventCountersChanged)
 
 public:
+    enum ConnectionState {
+        Disconnected,
+        WaitingForServer, // see connectWhenReady()
+        Connecting,
+        Connected,
+    };
+    Q_ENUM(ConnectionState)
+
     VncClient(QObject *parent = nullptr);
     virtual ~VncClient();
 
     bool isConnected() const;
+    ConnectionState connectionState() const;
+
+    /* Space-separated list of encoding names, as understood by
+     * libvncclient; an empty string selects the libvncclient defaults */
+    void setEncodings(const QString &encodings);
+    QString encodings() const;
+
+    void setCompressLevel(int level);
+    int compressLevel() const;
+
+    void setQualityLevel(int level);
+    int qualityLevel() const;
+
+    /* Either 32 (RGB32) or 16 (RGB565); takes effect on the next
+     * connection */
+    void setPixelDepth(int depth);
+    int pixelDepth() const;
+
+    /* When set, `encodings` is ignored and the encodings are chosen by
+     * measuring their decoding cost on the actual connection */
+    void setAutomaticEncoding(bool automatic);
+    bool automaticEncoding() const;
+
+    QString activeEncodings() const;
 
+    /* Upper limit to the rate of framebuffer updates; 0 means that updates
+     * are only paced by the display */
+    void setMaxFps(int fps);
+    int maxFps() const;
+
+    /* Whether the server is pushing updates without waiting for our
+     * requests; only possible while a viewer is visible */
+    bool continuousUpdates() const;
+    /* In milliseconds, measured with fences; -1 if the server doesn't
+     * support them */
+    qreal roundTripTime() const;
+
+    VncStats *stats() const;
+
+    /* If set, the data sent by the server is recorded to this file, for the
+     * connections made from then on; see replay() */
+    void setRecordFile(const QString &fileName);
+    QString recordFile() const;
+    /* The statistics of the frame returned by image() */
+    const VncFrameStats &frameStats() const;
+
+    quint64 pointerEventsReceived() const;
+    quint64 pointerEventsSent() const;
+
+    /* Framebuffer updates are paused while none of the viewers is visible,
+     * and resume with a full refresh */
     void addViewer(QQuickItem *viewer);
     void removeViewer(QQuickItem *viewer);
     const QImage &image() const;
+    /* Set instead of image() when the frame is a GPU buffer shared by a
+     * local display; null otherwise */
+    QSharedPointer<const DmabufBuffer> dmabuf() const;
+    /* The size of the current frame, whichever form it has */
+    QSize frameSize() const;
+    /* The cursor sprite, if the server sends it separately from the
+     * framebuffer; viewers are expected to draw it at the local pointer
+     * position. Null if the cursor is part of the framebuffer, or hidden. */
+    const QImage &cursorImage() const;
+    QPoint cursorHotspot() const;
+    /* Makes the most recent frame (if any) the one returned by image(), and
+     * emits frameBufferUpdated(). Viewers call this once per display frame,
+     * after frameAvailable() has been emitted. */
+    void latchFrame();
 
-    Q_INVOKABLE bool connectToServer(const QString &host, const QString &password);
+    /* Returns immediately: the handshake happens off the GUI thread; follow
+     * `connectionState` for the outcome */
+    Q_INVOKABLE void connectToServer(const QString &host, const QString &password);
+    /* Connects to the local display of a QEMU started with
+     * `-display dbus,p2p=yes`, through the QMP monitor at `qmpSocket`: the
+     * framebuffer is then shared with QEMU instead of being transferred
+     * over VNC; see ShmDisplay. Like connectToServer(), it returns before
+     * the connection is made. */
+    Q_INVOKABLE void connectToDisplay(const QString &qmpSocket);
+    /* Returns immediately, and connects as soon as the server accepts:
+     * local sockets are watched until they get created, and failed
+     * attempts are retried with an exponential backoff, until connected or
+     * until disconnect() is called. If `qmpSocket` is given, the shared
+     * memory display is preferred over VNC. The handshake happens off the
+     * GUI thread; follow `connectionState` for the progress. */
+    Q_INVOKABLE void connectWhenReady(const QString &host,
+                                      const QString &password = QString(),
+                                      const QString &qmpSocket = QString());
     Q_INVOKABLE void disconnect();
+    /* Plays back a recorded session through the whole decoding and painting
+     * pipeline, either with the original timing or as fast as possible; a
+     * summary of the performance is logged at the end, and `stats` can be
+     * inspected while it runs. Like connectToServer(), it returns before
+     * the connection is made; false means the file cannot be played. */
+    Q_INVOKABLE bool replay(const QString &fileName, bool realTime = false);
+    /* Asks the server to resize the remote desktop; this needs a guest
+     * display driver which supports it */
+    Q_INVOKABLE void requestDesktopSize(const QSize &size);
 
+    /* Key events are queued, and written together when control returns to
+     * the event loop */
     void sendKeyEvent(QChar c);
     void sendKeyEvent(QKeyEvent *keyEvent, bool pressed);
+    /* Types the text at once; line breaks become the Return key */
+    Q_INVOKABLE void sendText(const QString &text);
+    /* Releases the keys still held in the remote desktop, for example when
+     * losing the focus */
+    Q_INVOKABLE void releaseKeys();
+
+    /* Types the text at `pasteRate` characters per second (or at once, if
+     * that's 0), after whatever is still being pasted */
+    Q_INVOKABLE void pasteText(const QString &text);
+    Q_INVOKABLE void pasteClipboard();
+    Q_INVOKABLE void cancelPaste();
+    bool isPasting() const;
+    void setPasteRate(int rate);
+    int pasteRate() const;
+
     Q_INVOKABLE void sendMouseEvent(const QPointF &pos,
                                     Qt::MouseButtons buttons);
 
 Q_SIGNALS:
     void connectionStatusChanged();
+    void connectionStateChanged();
+    void encodingsChanged();
+    void compressLevelChanged();
+    void qualityLevelChanged();
+    void pixelDepthChanged();
+    void automaticEncodingChanged();
+    void activeEncodingsChanged();
+    void maxFpsChanged();
+    void recordFileChanged();
+    void continuousUpdatesChanged();
+    void roundTripTimeChanged();
+    void pointerEventCountersChanged();
+    void pastingChanged();
+    void pasteRateChanged();
+    void frameAvailable();
+    void cursorChanged();
+    /* Emitted once per FramebufferUpdate message; the region is in remote
+     * framebuffer coordinates. */
+    void frameBufferUpdated(const QRegion &damage);
 
 private:
     Q_DECLARE_PRIVATE(VncClient)
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_downscaler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+using namespace LomiriVNC;
+
+static const int maxFactor = 8;
+
+static inline quint32 average4(quint32 a, quint32 b, quint32 c, quint32 d)
+{
+    /* Red and blue, then alpha and green, two channels at a time: each
+     * 16-bit field has room for the sum of four 8-bit values */
+    const quint32 rb = ((a & 0x00ff00ff) + (b & 0x00ff00ff) +
+                        (c & 0x00ff00ff) + (d & 0x00ff00ff) +
+                        0x00020002) >> 2;
+    const quint32 ag = (((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+                        ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) +
+                        0x00020002) >> 2;
+    return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+int VncDownscaler::factorForScale(qreal scale)
+{
+    int factor = 1;
+    while (factor < maxFactor && scale * factor * 2 <= 1.0) {
+        factor *= 2;
+    }
+    return factor;
+}
+
+void VncDownscaler::halveRow(const quint32 *row0, const quint32 *row1,
+                             quint32 *out, int count)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    /* Four output pixels per iteration. The averages are rounded twice,
+     * which is invisible in practice. */
+    for (; i + 4 <= count; i += 4) {
+        const __m128i *p0 = reinterpret_cast<const __m128i*>(row0 + i * 2);
+        const __m128i *p1 = reinterpret_cast<const __m128i*>(row1 + i * 2);
+        __m128i a = _mm_avg_epu8(_mm_loadu_si128(p0), _mm_loadu_si128(p1));
+        __m128i b = _mm_avg_epu8(_mm_loadu_si128(p0 + 1),
+                                 _mm_loadu_si128(p1 + 1));
+        __m128 af = _mm_castsi128_ps(a);
+        __m128 bf = _mm_castsi128_ps(b);
+        __m128i even = _mm_castps_si128(
+            _mm_shuffle_ps(af, bf, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i odd = _mm_castps_si128(
+            _mm_shuffle_ps(af, bf, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         _mm_avg_epu8(even, odd));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= count; i += 4) {
+        /* vld2 de-interleaves the even and the odd pixels */
+        uint32x4x2_t a = vld2q_u32(row0 + i * 2);
+        uint32x4x2_t b = vld2q_u32(row1 + i * 2);
+        uint8x16_t top = vrhaddq_u8(vreinterpretq_u8_u32(a.val[0]),
+                                    vreinterpretq_u8_u32(a.val[1]));
+        uint8x16_t bottom = vrhaddq_u8(vreinterpretq_u8_u32(b.val[0]),
+                                       vreinterpretq_u8_u32(b.val[1]));
+        vst1q_u32(out + i, vreinterpretq_u32_u8(vrhaddq_u8(top, bottom)));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = average4(row0[i * 2], row0[i * 2 + 1],
+                          row1[i * 2], row1[i * 2 + 1]);
+    }
+}
+
+void VncDownscaler::halve(const QImage &source, QImage *dest,
+                          const QRect &rect)
+{
+    const int sourceWidth = source.width();
+    const int sourceHeight = source.height();
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        const int y0 = y * 2;
+        const int y1 = qMin(y0 + 1, sourceHeight - 1);
+        const quint32 *row0 =
+            reinterpret_cast<const quint32*>(source.constScanLine(y0));
+        const quint32 *row1 =
+            reinterpret_cast<const quint32*>(source.constScanLine(y1));
+        quint32 *out = reinterpret_cast<quint32*>(dest->scanLine(y));
+
+        /* The last column needs clamping if the source width is odd */
+        int right = rect.right();
+        if (right * 2 + 1 >= sourceWidth) right--;
+        const int left = rect.left();
+        if (right >= left) {
+            halveRow(row0 + left * 2, row1 + left * 2, out + left,
+                     right - left + 1);
+        }
+        for (int x = qMax(right + 1, left); x <= rect.right(); x++) {
+            const int x0 = x * 2;
+            const int x1 = qMin(x0 + 1, sourceWidth - 1);
+            out[x] = average4(row0[x0], row0[x1], row1[x0], row1[x1]);
+        }
+    }
+}
+
+const QImage &VncDownscaler::downscale(const QImage &source, int factor,
+                                       QRegion *damage)
+{
+    int levelCount = 0;
+    while ((2 << levelCount) <= qMin(factor, maxFactor)) levelCount++;
+    m_levels.resize(levelCount);
+
+    const QImage *previous = &source;
+    for (QImage &level: m_levels) {
+        const QSize size((previous->width() + 1) / 2,
+                         (previous->height() + 1) / 2);
+        if (level.size() != size || level.format() != source.format()) {
+            level = QImage(size, source.format());
+            *damage = previous->rect();
+        }
+
+        /* Map the damage onto this level, rounding outwards */
+        QRegion levelDamage;
+        const QRect bounds = level.rect();
+        for (const QRect &r: *damage) {
+            QRect mapped(QPoint(r.left() / 2, r.top() / 2),
+                         QPoint(r.right() / 2, r.bottom() / 2));
+            mapped &= bounds;
+            if (mapped.isEmpty()) continue;
+            halve(*previous, &level, mapped);
+            levelDamage += mapped;
+        }
+        *damage = levelDamage;
+        previous = &level;
+    }
+    return *previous;
+}
+
+void VncDownscaler::clear()
+{
+    m_levels.clear();
+}
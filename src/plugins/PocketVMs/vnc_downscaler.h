@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_VNC_DOWNSCALER_H
+#define LOMIRIVNC_VNC_DOWNSCALER_H
+
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <QVector>
+
+namespace LomiriVNC {
+
+/* Box-filter downscaling of RGB32 frames, by powers of two.
+ *
+ * Bilinear sampling on the GPU is fine down to half size, but below that it
+ * starts skipping source pixels, and text becomes unreadable. This computes
+ * a chain of half-sized images (like mipmap levels, but only for the
+ * damaged areas of each frame); the GPU then only has to cover the
+ * remaining factor, which is less than two.
+ */
+class VncDownscaler
+{
+public:
+    /* The power of two by which the source should be reduced before being
+     * drawn at `scale`; 1 means no reduction */
+    static int factorForScale(qreal scale);
+
+    /* Returns the source reduced by `factor` (a power of two, greater than
+     * one); only the areas in `damage` (in source coordinates) are updated,
+     * and `damage` is then replaced with the changed area of the returned
+     * image. */
+    const QImage &downscale(const QImage &source, int factor,
+                            QRegion *damage);
+    void clear();
+
+    /* Averages 2x2 blocks: `count` output pixels are computed out of
+     * 2 * count pixels from each of the two rows */
+    static void halveRow(const quint32 *row0, const quint32 *row1,
+                         quint32 *out, int count);
+
+private:
+    static void halve(const QImage &source, QImage *dest, const QRect &rect);
+
+    QVector<QImage> m_levels;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_VNC_DOWNSCALER_H
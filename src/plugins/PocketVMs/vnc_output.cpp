@@ -19,20 +19,52 @@
 
 #include "vnc_output.h"
 
+#include "dmabuf_texture.h"
 #include "scaler.h"
 #include "vnc_client.h"
+#include "vnc_downscaler.h"
+#include "vnc_texture.h"
 
+#include <QAbstractAnimation>
+#include <QCursor>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QImage>
 #include <QMouseEvent>
-#include <QPainter>
 #include <QPointF>
+#include <QQuickWindow>
+#include <QRegion>
+#include <QSGImageNode>
+#include <QSGRectangleNode>
+#include <QSGRendererInterface>
+#include <QSharedPointer>
+#include <QTimer>
 #include <QTransform>
+#include <QtMath>
 
 using namespace LomiriVNC;
 
 namespace LomiriVNC {
 
+class VncOutputPrivate;
+
+/* Driven by the animation driver, so that each step happens once per
+ * display frame */
+class VncKineticAnimation: public QAbstractAnimation
+{
+public:
+    VncKineticAnimation(VncOutputPrivate *d): m_d(d), m_lastTime(0) {}
+    int duration() const override { return -1; }
+
+protected:
+    void updateCurrentTime(int currentTime) override;
+    void updateState(State newState, State oldState) override;
+
+private:
+    VncOutputPrivate *m_d;
+    int m_lastTime;
+};
+
 class VncOutputPrivate {
     Q_DECLARE_PUBLIC(VncOutput)
 
@@ -41,8 +73,21 @@ public:
     ~VncOutputPrivate();
 
     void setScale(qreal scale);
-    void setCenter(const QPointF &center);
-    void updateMapping();
+    bool setCenter(const QPointF &center);
+    bool updateMapping() { return updateMapping(m_center); }
+    bool updateMapping(const QPointF &center);
+    void setGestureActive(bool active);
+    void scheduleRemoteResize();
+    void requestRemoteResize();
+    bool kineticStep(qreal seconds);
+    void onKineticStopped();
+    void onFrameBufferUpdated(const QRegion &damage);
+    void onCursorChanged();
+    QSGNode *updatePaintNode(QSGNode *oldNode);
+    void updateCursorNode(QSGImageNode *node);
+    QSGNode *updateDmabufNode(QSGRectangleNode *background,
+                              QSGImageNode *imageNode,
+                              const QSharedPointer<const DmabufBuffer> &buffer);
 
     void sendKeyEvent(const QString &text);
     void sendMouseEvent(const QPointF &pos, Qt::MouseButtons buttons);
@@ -57,6 +102,24 @@ private:
     qreal m_requestedScale;
     qreal m_scale;
     QPointF m_center;
+    QRegion m_pendingDamage;
+    Scaler m_scaler;
+    bool m_gestureActive;
+    QPointF m_velocity; // item pixels per second
+    qreal m_flickDeceleration;
+    VncKineticAnimation m_kinetic;
+    bool m_autoResize;
+    bool m_resizeToPhysicalPixels;
+    QTimer m_resizeTimer;
+    bool m_useVncTexture;
+    bool m_showingDmabuf; // the node holds a DmabufTexture
+    VncDownscaler m_downscaler;
+    int m_textureFactor; // how much the texture is reduced from the frame
+    qint64 m_lastPaintedFrame; // VncFrameStats::readableAt
+    /* The remote cursor is drawn by us, where the local pointer is */
+    QPointF m_pointerPos;
+    bool m_pointerInside;
+    bool m_cursorDirty; // the cursor texture must be recreated
     VncOutput *q_ptr;
 };
 
@@ -66,97 +129,442 @@ VncOutputPrivate::VncOutputPrivate(VncOutput *q):
     m_client(nullptr),
     m_requestedScale(0.0),
     m_scale(0.0),
+    m_gestureActive(false),
+    m_flickDeceleration(1500.0),
+    m_kinetic(this),
+    m_autoResize(false),
+    m_resizeToPhysicalPixels(false),
+    m_useVncTexture(false),
+    m_showingDmabuf(false),
+    m_textureFactor(1),
+    m_lastPaintedFrame(0),
+    m_pointerInside(false),
+    m_cursorDirty(false),
     q_ptr(q)
 {
+    m_resizeTimer.setSingleShot(true);
+    m_resizeTimer.setInterval(500);
+    QObject::connect(&m_resizeTimer, &QTimer::timeout,
+                     q, [this]() { requestRemoteResize(); });
+}
+
+VncOutputPrivate::~VncOutputPrivate()
+{
+    m_gestureActive = false;
+    m_kinetic.stop();
+}
+
+void VncKineticAnimation::updateCurrentTime(int currentTime)
+{
+    const int elapsed = currentTime - m_lastTime;
+    m_lastTime = currentTime;
+    if (!m_d->kineticStep(elapsed / 1000.0)) {
+        stop();
+    }
+}
+
+void VncKineticAnimation::updateState(State newState, State oldState)
+{
+    Q_UNUSED(oldState);
+    if (newState == Running) {
+        m_lastTime = 0;
+    } else if (newState == Stopped) {
+        m_d->onKineticStopped();
+    }
+}
+
+void VncOutputPrivate::setGestureActive(bool active)
+{
+    Q_Q(VncOutput);
+
+    if (active == m_gestureActive) return;
+    m_gestureActive = active;
+    Q_EMIT q->gestureActiveChanged();
+
+    /* Back to full quality filtering, and to the latest frame */
+    if (!active) {
+        q->polish();
+        q->update();
+    }
+}
+
+bool VncOutputPrivate::kineticStep(qreal seconds)
+{
+    Q_Q(VncOutput);
+
+    if (m_scale <= 0 || seconds <= 0) return m_scale > 0;
+
+    /* The content follows the velocity, so the center of the view (in
+     * remote coordinates) moves the opposite way. The Scaler clamps it, and
+     * a clamped axis loses its momentum. */
+    const QPointF requested = m_center - m_velocity * seconds / m_scale;
+    if (setCenter(requested)) {
+        q->update();
+    }
+    if (m_center.x() != requested.x()) m_velocity.setX(0);
+    if (m_center.y() != requested.y()) m_velocity.setY(0);
+
+    const qreal speed = qSqrt(QPointF::dotProduct(m_velocity, m_velocity));
+    const qreal newSpeed = speed - m_flickDeceleration * seconds;
+    if (newSpeed <= 0) return false;
+    m_velocity *= newSpeed / speed;
+    return true;
+}
+
+void VncOutputPrivate::scheduleRemoteResize()
+{
+    if (m_autoResize) {
+        m_resizeTimer.start();
+    }
+}
+
+void VncOutputPrivate::requestRemoteResize()
+{
+    Q_Q(VncOutput);
+
+    if (!m_autoResize || !m_client) return;
+
+    QSizeF size = q->size();
+    if (m_resizeToPhysicalPixels && q->window()) {
+        size *= q->window()->effectiveDevicePixelRatio();
+    }
+    if (size.isEmpty()) return;
+    m_client->requestDesktopSize(size.toSize());
 }
 
-VncOutputPrivate::~VncOutputPrivate() = default;
+void VncOutputPrivate::onKineticStopped()
+{
+    m_velocity = QPointF();
+    setGestureActive(false);
+}
 
-void VncOutputPrivate::setCenter(const QPointF &center)
+bool VncOutputPrivate::setCenter(const QPointF &center)
 {
-    m_center = center;
-    updateMapping();
+    return updateMapping(center);
 }
 
-void VncOutputPrivate::updateMapping()
+/* Returns whether the mapping between the item and the remote framebuffer
+ * has changed; signals are only emitted for the properties which did.
+ * `center` is the requested one, m_center is only updated here so that
+ * centerChanged() is not missed. */
+bool VncOutputPrivate::updateMapping(const QPointF &center)
 {
     Q_Q(VncOutput);
 
     qreal oldScale = m_scale;
     QSizeF oldVncSize = m_vncSize;
     QRectF oldPaintedRect = m_paintedRect;
+    QPointF oldCenter = m_center;
+    QTransform oldItemToVnc = m_itemToVnc;
 
     qreal w = q->width();
     qreal h = q->height();
 
-    m_vncSize = m_client ? m_client->image().size() : QSize();
+    m_vncSize = m_client ? m_client->frameSize() : QSize();
     Scaler::InputData in {
         m_vncSize,
         QSizeF(w, h),
         m_requestedScale,
-        m_center,
+        center,
     };
 
     Scaler::OutputData out;
-    bool ok = Scaler::updateMapping(in, &out);
+    bool ok = m_scaler.map(in, &out);
     if (Q_LIKELY(ok)) {
         m_vncVisibleRect = out.sourceVisibleRect.toRect();
         m_paintedRect = out.itemPaintedRect;
         m_scale = out.scale;
         m_center = out.center;
         m_itemToVnc = out.itemToSource;
+        m_vncToItem = out.sourceToItem;
     } else {
         m_vncVisibleRect = QRect();
         m_paintedRect = QRectF();
         m_scale = 0.0;
         m_center = QPointF();
         m_itemToVnc = QTransform();
+        m_vncToItem = QTransform();
     }
 
-    m_vncToItem = m_itemToVnc.inverted();
-
     if (m_scale != oldScale) {
         Q_EMIT q->scaleChanged();
     }
-    Q_EMIT q->centerChanged();
+    if (m_center != oldCenter) {
+        Q_EMIT q->centerChanged();
+    }
     if (m_vncSize != oldVncSize) {
         Q_EMIT q->remoteScreenSizeChanged();
     }
     if (m_paintedRect != oldPaintedRect) {
         Q_EMIT q->marginsChanged();
     }
+    return m_paintedRect != oldPaintedRect || m_itemToVnc != oldItemToVnc;
 }
 
-void VncOutputPrivate::sendKeyEvent(const QString &text)
+void VncOutputPrivate::onFrameBufferUpdated(const QRegion &damage)
+{
+    Q_Q(VncOutput);
+
+    if (m_client->frameSize() != m_vncSize) {
+        updateMapping();
+    }
+
+    /* The damage is collected here and uploaded to the texture at the next
+     * scene graph synchronization; several updates arriving in the same
+     * frame result in a single repaint. */
+    m_pendingDamage += damage;
+    q->update();
+}
+
+void VncOutputPrivate::onCursorChanged()
 {
-    for (const QChar c: text) {
-        m_client->sendKeyEvent(c);
+    Q_Q(VncOutput);
+
+    /* Don't show two pointers */
+    if (m_client && !m_client->cursorImage().isNull()) {
+        q->setCursor(Qt::BlankCursor);
+    } else {
+        q->unsetCursor();
     }
+    m_cursorDirty = true;
+    q->update();
+}
+
+QSGNode *VncOutputPrivate::updatePaintNode(QSGNode *oldNode)
+{
+    Q_Q(VncOutput);
+
+    QQuickWindow *window = q->window();
+    QSGRectangleNode *background = static_cast<QSGRectangleNode*>(oldNode);
+    QSGImageNode *imageNode = nullptr;
+    QSGImageNode *cursorNode = nullptr;
+    if (!background) {
+        background = window->createRectangleNode();
+        background->setColor(Qt::black);
+
+        imageNode = window->createImageNode();
+        imageNode->setOwnsTexture(true);
+        background->appendChildNode(imageNode);
+
+        /* Keep a persistent texture only where we know how to update it
+         * partially; other backends (such as the software one, used when
+         * running headless) get a new texture for each frame. */
+        QSGRendererInterface *ri = window->rendererInterface();
+        m_useVncTexture = ri->graphicsApi() == QSGRendererInterface::OpenGL;
+        if (m_useVncTexture) {
+            imageNode->setTexture(new VncTexture);
+        }
+        m_showingDmabuf = false;
+        m_pendingDamage = QRect(QPoint(0, 0), m_vncSize);
+
+        /* Above the framebuffer */
+        cursorNode = window->createImageNode();
+        cursorNode->setOwnsTexture(true);
+        background->appendChildNode(cursorNode);
+        m_cursorDirty = true;
+    } else {
+        imageNode = static_cast<QSGImageNode*>(background->firstChild());
+        cursorNode = static_cast<QSGImageNode*>(background->lastChild());
+    }
+    background->setRect(q->boundingRect());
+    updateCursorNode(cursorNode);
+
+    /* Frames rendered by the GPU of the guest are sampled in place */
+    const QSharedPointer<const DmabufBuffer> buffer =
+        m_client && m_useVncTexture ?
+        m_client->dmabuf() : QSharedPointer<const DmabufBuffer>();
+    if (buffer) {
+        return updateDmabufNode(background, imageNode, buffer);
+    }
+    if (m_showingDmabuf) {
+        m_showingDmabuf = false;
+        imageNode->setTexture(new VncTexture);
+        imageNode->setTextureCoordinatesTransform(
+            QSGImageNode::NoTransform);
+        m_pendingDamage = QRect(QPoint(0, 0), m_vncSize);
+    }
+
+    const QImage image = m_client ? m_client->image() : QImage();
+    if (image.size() != m_vncSize) {
+        /* The mapping will be updated from the GUI thread once the client
+         * notifies us; until then, just make sure the texture is complete. */
+        m_pendingDamage = image.rect();
+    }
+
+    if (image.isNull() || m_paintedRect.isEmpty()) {
+        /* An image node without a texture would not be rendered at all, but
+         * make sure it doesn't show any stale content */
+        imageNode->setRect(QRectF());
+        m_pendingDamage = QRegion();
+        return background;
+    }
+
+    /* Below half size, the frame is first reduced on the CPU; during a
+     * gesture we keep whatever the texture holds. */
+    int factor = m_textureFactor;
+    if (image.format() != QImage::Format_RGB32) {
+        factor = 1;
+    } else if (!m_gestureActive) {
+        factor = q->antialiasing() ?
+            VncDownscaler::factorForScale(m_scale) : 1;
+    }
+    if (factor != m_textureFactor) {
+        m_textureFactor = factor;
+        m_pendingDamage = image.rect();
+        if (factor == 1) m_downscaler.clear();
+    }
+
+    if (!m_pendingDamage.isEmpty()) {
+        QElapsedTimer paintTimer;
+        paintTimer.start();
+        QRegion damage = m_pendingDamage;
+        const QImage &textureImage = m_textureFactor > 1 ?
+            m_downscaler.downscale(image, m_textureFactor, &damage) : image;
+        if (m_useVncTexture) {
+            VncTexture *texture = static_cast<VncTexture*>(imageNode->texture());
+            texture->upload(textureImage, damage);
+            imageNode->markDirty(QSGNode::DirtyMaterial);
+        } else {
+            imageNode->setTexture(
+                window->createTextureFromImage(textureImage.copy()));
+        }
+        m_pendingDamage = QRegion();
+
+        /* Repaints of the same frame (on resizes, for example) would
+         * distort the latency figures */
+        const VncFrameStats &frameStats = m_client->frameStats();
+        if (frameStats.readableAt != m_lastPaintedFrame) {
+            m_lastPaintedFrame = frameStats.readableAt;
+            m_client->stats()->addPaint(frameStats.readableAt,
+                                        paintTimer.nsecsElapsed());
+        }
+    }
+
+    /* Scaling and panning happen on the GPU: we just need to tell which part
+     * of the texture ends up where. */
+    imageNode->setFiltering(q->antialiasing() && !m_gestureActive ?
+                            QSGTexture::Linear : QSGTexture::Nearest);
+    imageNode->setRect(m_paintedRect);
+    const QRectF sourceRect = m_itemToVnc.mapRect(m_paintedRect);
+    const qreal reduction = m_textureFactor;
+    imageNode->setSourceRect(QRectF(sourceRect.topLeft() / reduction,
+                                    sourceRect.size() / reduction));
+    return background;
+}
+
+void VncOutputPrivate::updateCursorNode(QSGImageNode *node)
+{
+    Q_Q(VncOutput);
+
+    const QImage cursor = m_client ? m_client->cursorImage() : QImage();
+    if (cursor.isNull() || !m_pointerInside || m_scale <= 0) {
+        node->setRect(QRectF());
+        return;
+    }
+    if (m_cursorDirty) {
+        node->setTexture(q->window()->createTextureFromImage(cursor));
+        m_cursorDirty = false;
+    }
+
+    /* The cursor is scaled along with the framebuffer */
+    const QPointF hotspot = QPointF(m_client->cursorHotspot()) * m_scale;
+    node->setRect(QRectF(m_pointerPos - hotspot,
+                         QSizeF(cursor.size()) * m_scale));
+    node->setFiltering(q->antialiasing() ?
+                       QSGTexture::Linear : QSGTexture::Nearest);
+}
+
+QSGNode *VncOutputPrivate::updateDmabufNode(
+    QSGRectangleNode *background, QSGImageNode *imageNode,
+    const QSharedPointer<const DmabufBuffer> &buffer)
+{
+    Q_Q(VncOutput);
+
+    if (!m_showingDmabuf) {
+        m_showingDmabuf = true;
+        imageNode->setTexture(new DmabufTexture);
+        m_downscaler.clear();
+        m_textureFactor = 1;
+    }
+    if (buffer->size != m_vncSize) {
+        m_pendingDamage = QRect(QPoint(0, 0), buffer->size);
+    }
+
+    QElapsedTimer paintTimer;
+    paintTimer.start();
+    DmabufTexture *texture = static_cast<DmabufTexture*>(imageNode->texture());
+    if (!texture->setBuffer(buffer) || m_paintedRect.isEmpty()) {
+        imageNode->setRect(QRectF());
+        m_pendingDamage = QRegion();
+        return background;
+    }
+    if (!m_pendingDamage.isEmpty()) {
+        /* The texture is the buffer itself: the damage only tells that the
+         * GPU has written to it */
+        imageNode->markDirty(QSGNode::DirtyMaterial);
+        m_pendingDamage = QRegion();
+
+        const VncFrameStats &frameStats = m_client->frameStats();
+        if (frameStats.readableAt != m_lastPaintedFrame) {
+            m_lastPaintedFrame = frameStats.readableAt;
+            m_client->stats()->addPaint(frameStats.readableAt,
+                                        paintTimer.nsecsElapsed());
+        }
+    }
+
+    /* There is no downscaling here: mipmapping the buffer would cost more
+     * than sampling it */
+    imageNode->setFiltering(q->antialiasing() && !m_gestureActive ?
+                            QSGTexture::Linear : QSGTexture::Nearest);
+    imageNode->setRect(m_paintedRect);
+    QRectF sourceRect = m_itemToVnc.mapRect(m_paintedRect);
+    if (buffer->y0Top) {
+        imageNode->setTextureCoordinatesTransform(QSGImageNode::NoTransform);
+    } else {
+        /* Bottom-up rows, as left by OpenGL */
+        sourceRect.moveTop(buffer->size.height() - sourceRect.bottom());
+        imageNode->setTextureCoordinatesTransform(
+            QSGImageNode::MirrorVertically);
+    }
+    imageNode->setSourceRect(sourceRect);
+    return background;
+}
+
+void VncOutputPrivate::sendKeyEvent(const QString &text)
+{
+    if (Q_UNLIKELY(!m_client) || text.isEmpty()) return;
+    m_client->sendText(text);
 }
 
 void VncOutputPrivate::sendMouseEvent(const QPointF &pos,
                                       Qt::MouseButtons buttons)
 {
-    if (Q_UNLIKELY(!m_client ||
-                   !m_paintedRect.contains(pos.toPoint()))) return;
+    Q_Q(VncOutput);
+
+    if (Q_UNLIKELY(!m_client)) return;
+
+    /* Moving the cursor is only a repaint of the scene, with no traffic on
+     * the framebuffer */
+    const bool inside = m_paintedRect.contains(pos.toPoint());
+    if (inside != m_pointerInside || (inside && pos != m_pointerPos)) {
+        m_pointerInside = inside;
+        m_pointerPos = pos;
+        if (!m_client->cursorImage().isNull()) q->update();
+    }
+    if (!inside) return;
 
     m_client->sendMouseEvent(m_itemToVnc.map(pos), buttons);
 }
 
 VncOutput::VncOutput(QQuickItem *parent):
-    QQuickPaintedItem(parent),
+    QQuickItem(parent),
     d_ptr(new VncOutputPrivate(this))
 {
-    setFillColor(QColor(Qt::black));
-    setOpaquePainting(true);
+    setFlag(QQuickItem::ItemHasContents, true);
     setAntialiasing(true);
     setAcceptedMouseButtons(Qt::AllButtons);
     setAcceptHoverEvents(true);
     setFlag(QQuickItem::ItemAcceptsInputMethod, true);
-    /* For some reason if FBO rendering is enabled, only the first
-     * frame is drawn, unless the image is a different one
-     */
-    //setRenderTarget(QQuickPaintedItem::FramebufferObject);
 }
 
 VncOutput::~VncOutput() = default;
@@ -166,13 +574,28 @@ void VncOutput::setClient(VncClient *client)
     Q_D(VncOutput);
     if (client == d->m_client) return;
 
+    if (d->m_client) {
+        d->m_client->removeViewer(this);
+        QObject::disconnect(d->m_client, nullptr, this, nullptr);
+    }
     if (client) {
         client->addViewer(this);
-    } else if (d->m_client) {
-        d->m_client->removeViewer(this);
+        QObject::connect(client, &VncClient::frameBufferUpdated,
+                         this, [d](const QRegion &damage) {
+            d->onFrameBufferUpdated(damage);
+        });
+        /* Latch new frames in the polish phase, which runs once per
+         * display frame, right before the scene graph synchronization */
+        QObject::connect(client, &VncClient::frameAvailable,
+                         this, &QQuickItem::polish);
+        QObject::connect(client, &VncClient::cursorChanged,
+                         this, [d]() { d->onCursorChanged(); });
     }
     d->m_client = client;
+    d->onCursorChanged();
     d->updateMapping();
+    d->scheduleRemoteResize();
+    update();
     Q_EMIT clientChanged();
 }
 
@@ -185,10 +608,13 @@ VncClient *VncOutput::client() const
 void VncOutput::setRequestedScale(qreal scale)
 {
     Q_D(VncOutput);
-    d->m_requestedScale = qMin(scale, 2.0);
+    scale = qMin(scale, 2.0);
+    if (scale == d->m_requestedScale) return;
+    d->m_requestedScale = scale;
     Q_EMIT requestedScaleChanged();
-    d->updateMapping();
-    update();
+    if (d->updateMapping()) {
+        update();
+    }
 }
 
 qreal VncOutput::requestedScale() const
@@ -206,8 +632,9 @@ qreal VncOutput::scale() const
 void VncOutput::setCenter(const QPointF &center)
 {
     Q_D(VncOutput);
-    d->setCenter(center);
-    update();
+    if (d->setCenter(center)) {
+        update();
+    }
 }
 
 QPointF VncOutput::center() const
@@ -258,35 +685,136 @@ QPointF VncOutput::vncToItem(const QPointF &p) const
     return d->m_vncToItem.map(p);
 }
 
-void VncOutput::paint(QPainter *painter)
+QSGNode *VncOutput::updatePaintNode(QSGNode *oldNode,
+                                    UpdatePaintNodeData *data)
 {
     Q_D(VncOutput);
+    Q_UNUSED(data);
+    return d->updatePaintNode(oldNode);
+}
 
-    const QImage &image = d->m_client->image();
-    if (image.size() != d->m_vncSize) {
-        d->updateMapping();
-        Q_EMIT remoteScreenSizeChanged();
-        Q_EMIT marginsChanged();
+void VncOutput::updatePolish()
+{
+    Q_D(VncOutput);
+    /* New frames are picked up when the gesture ends */
+    if (d->m_client && !d->m_gestureActive) {
+        d->m_client->latchFrame();
     }
-    painter->drawImage(d->m_paintedRect, image, d->m_vncVisibleRect);
+}
+
+void VncOutput::beginGesture()
+{
+    Q_D(VncOutput);
+    d->m_kinetic.stop();
+    d->setGestureActive(true);
+}
+
+void VncOutput::endGesture(const QPointF &velocity)
+{
+    Q_D(VncOutput);
+    if (!d->m_gestureActive) return;
+
+    if (velocity.isNull() || d->m_flickDeceleration <= 0) {
+        d->setGestureActive(false);
+        return;
+    }
+    d->m_velocity = velocity;
+    d->m_kinetic.start();
+}
+
+bool VncOutput::gestureActive() const
+{
+    Q_D(const VncOutput);
+    return d->m_gestureActive;
+}
+
+void VncOutput::setFlickDeceleration(qreal deceleration)
+{
+    Q_D(VncOutput);
+    if (deceleration == d->m_flickDeceleration) return;
+    d->m_flickDeceleration = deceleration;
+    Q_EMIT flickDecelerationChanged();
+}
+
+qreal VncOutput::flickDeceleration() const
+{
+    Q_D(const VncOutput);
+    return d->m_flickDeceleration;
 }
 
 void VncOutput::geometryChanged(const QRectF &newGeometry,
                                 const QRectF &oldGeometry)
 {
     Q_D(VncOutput);
-    QQuickPaintedItem::geometryChanged(newGeometry, oldGeometry);
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    /* Moving the item doesn't affect its contents */
+    if (newGeometry.size() == oldGeometry.size()) return;
     d->updateMapping();
-    Q_EMIT marginsChanged();
+    d->scheduleRemoteResize();
+    update();
+}
+
+void VncOutput::setAutoResize(bool autoResize)
+{
+    Q_D(VncOutput);
+    if (autoResize == d->m_autoResize) return;
+    d->m_autoResize = autoResize;
+    if (autoResize) {
+        d->scheduleRemoteResize();
+    } else {
+        d->m_resizeTimer.stop();
+        /* Don't keep asking for it on reconnections */
+        if (d->m_client) d->m_client->requestDesktopSize(QSize());
+    }
+    Q_EMIT autoResizeChanged();
+}
+
+bool VncOutput::autoResize() const
+{
+    Q_D(const VncOutput);
+    return d->m_autoResize;
+}
+
+void VncOutput::setResizeToPhysicalPixels(bool physical)
+{
+    Q_D(VncOutput);
+    if (physical == d->m_resizeToPhysicalPixels) return;
+    d->m_resizeToPhysicalPixels = physical;
+    d->scheduleRemoteResize();
+    Q_EMIT resizeToPhysicalPixelsChanged();
+}
+
+bool VncOutput::resizeToPhysicalPixels() const
+{
+    Q_D(const VncOutput);
+    return d->m_resizeToPhysicalPixels;
 }
 
 void VncOutput::hoverMoveEvent(QHoverEvent *event)
 {
     Q_D(VncOutput);
-    QQuickPaintedItem::hoverMoveEvent(event);
+    QQuickItem::hoverMoveEvent(event);
     d->sendMouseEvent(event->pos(), Qt::NoButton);
 }
 
+void VncOutput::hoverLeaveEvent(QHoverEvent *event)
+{
+    Q_D(VncOutput);
+    QQuickItem::hoverLeaveEvent(event);
+    d->m_pointerInside = false;
+    update();
+}
+
+void VncOutput::focusOutEvent(QFocusEvent *event)
+{
+    Q_D(VncOutput);
+    QQuickItem::focusOutEvent(event);
+    /* We won't see the releases anymore */
+    if (d->m_client && d->m_client->isConnected()) {
+        d->m_client->releaseKeys();
+    }
+}
+
 void VncOutput::inputMethodEvent(QInputMethodEvent *event)
 {
     Q_D(VncOutput);
@@ -296,7 +824,7 @@ void VncOutput::inputMethodEvent(QInputMethodEvent *event)
 
 QVariant VncOutput::inputMethodQuery(Qt::InputMethodQuery query) const
 {
-    QVariant ret = QQuickPaintedItem::inputMethodQuery(query);
+    QVariant ret = QQuickItem::inputMethodQuery(query);
     if (query == Qt::ImHints) {
         ret = int(Qt::ImhHiddenText |
                   Qt::ImhNoAutoUppercase |
@@ -324,7 +852,7 @@ void VncOutput::keyReleaseEvent(QKeyEvent *event)
 void VncOutput::mouseMoveEvent(QMouseEvent *event)
 {
     Q_D(VncOutput);
-    QQuickPaintedItem::mouseMoveEvent(event);
+    QQuickItem::mouseMoveEvent(event);
     d->sendMouseEvent(event->localPos(), event->buttons());
     event->accept();
 }
@@ -332,7 +860,7 @@ void VncOutput::mouseMoveEvent(QMouseEvent *event)
 void VncOutput::mousePressEvent(QMouseEvent *event)
 {
     Q_D(VncOutput);
-    QQuickPaintedItem::mousePressEvent(event);
+    QQuickItem::mousePressEvent(event);
     d->sendMouseEvent(event->localPos(), event->buttons());
     event->accept();
 }
@@ -340,7 +868,7 @@ void VncOutput::mousePressEvent(QMouseEvent *event)
 void VncOutput::mouseReleaseEvent(QMouseEvent *event)
 {
     Q_D(VncOutput);
-    QQuickPaintedItem::mouseReleaseEvent(event);
+    QQuickItem::mouseReleaseEvent(event);
     d->sendMouseEvent(event->localPos(), event->buttons());
     event->accept();
 }
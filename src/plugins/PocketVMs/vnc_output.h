@@ -22,14 +22,14 @@
 
 #include "vnc_client.h"
 
-#include <QQuickPaintedItem>
+#include <QQuickItem>
 #include <QScopedPointer>
 #include <QSizeF>
 
 namespace LomiriVNC {
 
 class VncOutputPrivate;
-class VncOutput: public QQuickPaintedItem
+class VncOutput: public QQuickItem
 {
     Q_OBJECT
     Q_PROPERTY(VncClient *client READ client WRITE setClient NOTIFY clientChanged)
@@ -43,6 +43,15 @@ class VncOutput: public QQuickPaintedItem
     Q_PROPERTY(qreal leftMargin READ leftMargin NOTIFY marginsChanged)
     Q_PROPERTY(qreal rightMargin READ rightMargin NOTIFY marginsChanged)
     Q_PROPERTY(qreal topMargin READ topMargin NOTIFY marginsChanged)
+    Q_PROPERTY(bool gestureActive READ gestureActive
+               NOTIFY gestureActiveChanged)
+    Q_PROPERTY(qreal flickDeceleration READ flickDeceleration
+               WRITE setFlickDeceleration NOTIFY flickDecelerationChanged)
+    Q_PROPERTY(bool autoResize READ autoResize WRITE setAutoResize
+               NOTIFY autoResizeChanged)
+    Q_PROPERTY(bool resizeToPhysicalPixels READ resizeToPhysicalPixels
+               WRITE setResizeToPhysicalPixels
+               NOTIFY resizeToPhysicalPixelsChanged)
 
 public:
     VncOutput(QQuickItem *parent = nullptr);
@@ -69,7 +78,29 @@ public:
     Q_INVOKABLE QPointF itemToVnc(const QPointF &p) const;
     Q_INVOKABLE QPointF vncToItem(const QPointF &p) const;
 
-    void paint(QPainter *painter) override;
+    /* While a pinch or pan gesture is active, the existing texture is only
+     * moved around and sampled with the cheapest filtering, and new frames
+     * are not uploaded. The gesture ends when endGesture() is called, or,
+     * if it's given a velocity (in item pixels per second), when the
+     * kinetic scrolling stops. */
+    Q_INVOKABLE void beginGesture();
+    Q_INVOKABLE void endGesture(const QPointF &velocity = QPointF());
+    bool gestureActive() const;
+
+    /* In item pixels per second squared */
+    void setFlickDeceleration(qreal deceleration);
+    qreal flickDeceleration() const;
+
+    /* When set, the remote desktop is asked to match the item size (once
+     * the size has been stable for a moment, so that rotations and
+     * animations don't cause a storm of resizes) */
+    void setAutoResize(bool autoResize);
+    bool autoResize() const;
+
+    /* Whether the size requested by autoResize is in physical pixels, as
+     * opposed to device independent ones */
+    void setResizeToPhysicalPixels(bool physical);
+    bool resizeToPhysicalPixels() const;
 
 Q_SIGNALS:
     void clientChanged();
@@ -78,11 +109,20 @@ Q_SIGNALS:
     void centerChanged();
     void remoteScreenSizeChanged();
     void marginsChanged();
+    void gestureActiveChanged();
+    void flickDecelerationChanged();
+    void autoResizeChanged();
+    void resizeToPhysicalPixelsChanged();
 
 protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode,
+                             UpdatePaintNodeData *data) override;
+    void updatePolish() override;
     void geometryChanged(const QRectF &newGeometry,
                          const QRectF &oldGeometry) override;
+    void focusOutEvent(QFocusEvent *event) override;
     void hoverMoveEvent(QHoverEvent *event) override;
+    void hoverLeaveEvent(QHoverEvent *event) override;
     void inputMethodEvent(QInputMethodEvent *event) override;
     QVariant inputMethodQuery(Qt::InputMethodQuery query) const override;
     void keyPressEvent(QKeyEvent *event) override;
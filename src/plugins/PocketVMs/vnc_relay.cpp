@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_relay.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace LomiriVNC;
+
+/* File format: the magic string, the header, and then a sequence of
+ * (timestamp in ns, QByteArray) pairs with the data sent by the server, all
+ * serialized with QDataStream. */
+static const char relayMagic[] = "PVMSRFB1";
+static const int relayMagicLength = sizeof(relayMagic) - 1;
+static const int acceptTimeout = 10000; // ms
+
+static bool fillAddress(const QString &path, sockaddr_un *address)
+{
+    QByteArray encoded = QFile::encodeName(path);
+    if (encoded.size() >= int(sizeof(address->sun_path))) {
+        qWarning() << "Socket path too long:" << path;
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, encoded.constData(), encoded.size());
+    return true;
+}
+
+static int connectTo(const QString &path)
+{
+    sockaddr_un address;
+    if (!fillAddress(path, &address)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)) < 0) {
+        qWarning() << "Could not connect to" << path << strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+VncRelay::VncRelay(Mode mode, const QString &fileName):
+    QThread(),
+    m_mode(mode),
+    m_fileName(fileName),
+    m_realTime(false),
+    m_listenSocket(-1),
+    m_stopped(false),
+    m_bytesRelayed(0)
+{
+    m_wakeup[0] = m_wakeup[1] = -1;
+    setObjectName("VNC relay");
+}
+
+VncRelay *VncRelay::recorder(const QString &serverPath,
+                             const QString &fileName,
+                             const Header &header)
+{
+    VncRelay *relay = new VncRelay(Record, fileName);
+    relay->m_serverPath = serverPath;
+    relay->m_header = header;
+    return relay;
+}
+
+VncRelay *VncRelay::player(const QString &fileName, bool realTime)
+{
+    VncRelay *relay = new VncRelay(Replay, fileName);
+    relay->m_realTime = realTime;
+    readHeader(fileName, &relay->m_header);
+    return relay;
+}
+
+VncRelay::~VncRelay()
+{
+    stop();
+}
+
+bool VncRelay::readHeader(const QString &fileName, Header *header)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open" << fileName << file.errorString();
+        return false;
+    }
+    if (file.read(relayMagicLength) != QByteArray(relayMagic)) {
+        qWarning() << fileName << "is not a VNC recording";
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    qint32 pixelDepth;
+    in >> pixelDepth >> header->encodings;
+    header->pixelDepth = pixelDepth;
+    return in.status() == QDataStream::Ok;
+}
+
+QString VncRelay::listen()
+{
+    static std::atomic<int> counter(0);
+    QString path = QStringLiteral("%1/pvms-vnc-%2-%3.sock")
+        .arg(QDir::tempPath()).arg(getpid()).arg(counter++);
+    sockaddr_un address;
+    if (!fillAddress(path, &address)) return QString();
+
+    if (pipe2(m_wakeup, O_CLOEXEC) < 0) {
+        qWarning() << "Could not create pipe:" << strerror(errno);
+        return QString();
+    }
+
+    m_listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(address.sun_path);
+    if (m_listenSocket < 0 ||
+        bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) < 0 ||
+        ::listen(m_listenSocket, 1) < 0) {
+        qWarning() << "Could not listen on" << path << strerror(errno);
+        return QString();
+    }
+
+    m_socketPath = path;
+    start();
+    return path;
+}
+
+void VncRelay::stop()
+{
+    m_stopped = true;
+    if (m_wakeup[1] >= 0) {
+        char c = 0;
+        ssize_t ret = write(m_wakeup[1], &c, 1);
+        Q_UNUSED(ret);
+    }
+    wait();
+
+    if (m_listenSocket >= 0) {
+        ::close(m_listenSocket);
+        m_listenSocket = -1;
+    }
+    if (!m_socketPath.isEmpty()) {
+        QFile::remove(m_socketPath);
+        m_socketPath.clear();
+    }
+    for (int &fd: m_wakeup) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+}
+
+int VncRelay::acceptClient()
+{
+    pollfd fds[2] = {
+        { m_listenSocket, POLLIN, 0 },
+        { m_wakeup[0], POLLIN, 0 },
+    };
+    int ret;
+    do {
+        ret = poll(fds, 2, acceptTimeout);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0 || fds[1].revents) return -1;
+
+    return accept4(m_listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+}
+
+void VncRelay::run()
+{
+    int client = acceptClient();
+    /* Only one connection is served */
+    ::close(m_listenSocket);
+    m_listenSocket = -1;
+    QFile::remove(m_socketPath);
+    if (client < 0) {
+        if (!m_stopped) qWarning() << "Nobody connected to the relay";
+        return;
+    }
+
+    if (m_mode == Record) {
+        record(client);
+    } else {
+        replay(client);
+    }
+    ::close(client);
+}
+
+bool VncRelay::sendAll(int socket, const char *data, int length)
+{
+    while (length > 0) {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+void VncRelay::record(int client)
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not open" << m_fileName << file.errorString();
+        return;
+    }
+    file.write(relayMagic, relayMagicLength);
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << qint32(m_header.pixelDepth) << m_header.encodings;
+
+    int server = connectTo(m_serverPath);
+    if (server < 0) return;
+
+    QElapsedTimer timer;
+    timer.start();
+    char buffer[65536];
+    pollfd fds[3] = {
+        { client, POLLIN, 0 },
+        { server, POLLIN, 0 },
+        { m_wakeup[0], POLLIN, 0 },
+    };
+    while (!m_stopped) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[2].revents) break;
+
+        if (fds[0].revents) {
+            ssize_t length = recv(client, buffer, sizeof(buffer), 0);
+            if (length <= 0 || !sendAll(server, buffer, length)) break;
+        }
+        if (fds[1].revents) {
+            ssize_t length = recv(server, buffer, sizeof(buffer), 0);
+            if (length <= 0) break;
+            out << timer.nsecsElapsed() <<
+                QByteArray::fromRawData(buffer, length);
+            m_bytesRelayed += length;
+            if (!sendAll(client, buffer, length)) break;
+        }
+    }
+    ::close(server);
+    qDebug() << "Recorded" << m_bytesRelayed.load() << "bytes to" <<
+        m_fileName;
+}
+
+bool VncRelay::waitForClient(int client, int timeout, bool writing)
+{
+    /* Whatever the client says is read and discarded, so that it never
+     * blocks on us */
+    char buffer[4096];
+    pollfd fds[2] = {
+        { client, short(POLLIN | (writing ? POLLOUT : 0)), 0 },
+        { m_wakeup[0], POLLIN, 0 },
+    };
+    while (!m_stopped) {
+        int ret = poll(fds, 2, timeout);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ret == 0) return true; // timeout
+        if (fds[1].revents) return false;
+        if (fds[0].revents & POLLIN) {
+            if (recv(client, buffer, sizeof(buffer), MSG_DONTWAIT) <= 0) {
+                return false;
+            }
+        } else if (fds[0].revents & (POLLERR | POLLHUP)) {
+            return false;
+        }
+        if (writing && (fds[0].revents & POLLOUT)) return true;
+    }
+    return false;
+}
+
+void VncRelay::replay(int client)
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly) ||
+        file.read(relayMagicLength) != QByteArray(relayMagic)) {
+        qWarning() << "Could not replay" << m_fileName;
+        return;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    qint32 pixelDepth;
+    QByteArray encodings;
+    in >> pixelDepth >> encodings;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_stopped && !in.atEnd()) {
+        qint64 timestamp;
+        QByteArray data;
+        in >> timestamp >> data;
+        if (in.status() != QDataStream::Ok) break;
+
+        if (m_realTime) {
+            qint64 remaining;
+            while ((remaining = timestamp - timer.nsecsElapsed()) > 0) {
+                if (!waitForClient(client, int(remaining / 1000000) + 1,
+                                   false)) return;
+            }
+        }
+
+        const char *p = data.constData();
+        int length = data.size();
+        while (length > 0) {
+            if (!waitForClient(client, -1, true)) return;
+            ssize_t sent = send(client, p, length,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return;
+            }
+            p += sent;
+            length -= sent;
+            m_bytesRelayed += sent;
+        }
+    }
+}
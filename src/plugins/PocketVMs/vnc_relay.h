@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_VNC_RELAY_H
+#define LOMIRIVNC_VNC_RELAY_H
+
+#include <QByteArray>
+#include <QString>
+#include <QThread>
+#include <atomic>
+
+namespace LomiriVNC {
+
+/* Sits between libvncclient and the VNC server, on a private UNIX socket.
+ *
+ * A recorder forwards all the traffic to the real server, and saves what
+ * the server sends, with timestamps, to a file. A player stands in for the
+ * server: it sends the recorded data (either with the original timing or as
+ * fast as the client reads it) and discards whatever the client sends.
+ * Since the server side is not interactive, a recording can only be played
+ * back by a client behaving like the one which recorded it, that is, with
+ * the same pixel depth.
+ *
+ * The relay serves a single connection, in its own thread.
+ */
+class VncRelay: public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Header {
+        Header(): pixelDepth(32) {}
+        int pixelDepth;
+        QByteArray encodings; // requested when recording; informative
+    };
+
+    static VncRelay *recorder(const QString &serverPath,
+                              const QString &fileName,
+                              const Header &header);
+    static VncRelay *player(const QString &fileName, bool realTime);
+    ~VncRelay();
+
+    static bool readHeader(const QString &fileName, Header *header);
+
+    /* Starts accepting a connection on a private socket, and returns its
+     * path; returns an empty string on failure */
+    QString listen();
+    void stop();
+
+    const Header &header() const { return m_header; }
+    /* Bytes sent by the server side so far */
+    quint64 bytesRelayed() const { return m_bytesRelayed.load(); }
+
+protected:
+    void run() override;
+
+private:
+    enum Mode {
+        Record,
+        Replay,
+    };
+
+    VncRelay(Mode mode, const QString &fileName);
+    int acceptClient();
+    void record(int client);
+    void replay(int client);
+    bool waitForClient(int client, int timeout, bool writing);
+    bool sendAll(int socket, const char *data, int length);
+
+private:
+    Mode m_mode;
+    QString m_fileName;
+    QString m_serverPath;
+    QString m_socketPath;
+    Header m_header;
+    bool m_realTime;
+    int m_listenSocket;
+    int m_wakeup[2];
+    std::atomic<bool> m_stopped;
+    std::atomic<quint64> m_bytesRelayed;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_VNC_RELAY_H
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_stats.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <chrono>
+
+using namespace LomiriVNC;
+
+namespace LomiriVNC {
+
+/* The most recent samples of a metric */
+class VncSeries {
+public:
+    VncSeries(): m_next(0) {}
+
+    void add(qint64 value) {
+        if (m_values.count() < windowSize) {
+            m_values.append(value);
+        } else {
+            m_values[m_next] = value;
+            m_next = (m_next + 1) % windowSize;
+        }
+    }
+
+    void clear() {
+        m_values.clear();
+        m_next = 0;
+    }
+
+    qreal average() const {
+        if (m_values.isEmpty()) return 0;
+        qint64 sum = 0;
+        for (qint64 value: m_values) sum += value;
+        return qreal(sum) / m_values.count();
+    }
+
+    qreal percentile(qreal p) const {
+        if (m_values.isEmpty()) return 0;
+        QVector<qint64> values = m_values;
+        int n = qBound(0, int(p / 100 * values.count()), values.count() - 1);
+        std::nth_element(values.begin(), values.begin() + n, values.end());
+        return values[n];
+    }
+
+private:
+    static const int windowSize = 120;
+    QVector<qint64> m_values;
+    int m_next;
+};
+
+class VncStatsPrivate {
+    Q_DECLARE_PUBLIC(VncStats)
+
+public:
+    VncStatsPrivate(VncStats *q);
+
+    const VncSeries &series(VncStats::Metric metric) const;
+    static qreal scale(VncStats::Metric metric);
+    void onTick();
+    void log() const;
+
+private:
+    QTimer m_timer;
+    QElapsedTimer m_tickTimer;
+    QElapsedTimer m_logTimer;
+    int m_logInterval;
+    quint64 m_frames;
+    quint64 m_droppedFrames;
+    quint64 m_tickFrames;
+    qint64 m_tickBytes;
+    qreal m_fps;
+    qreal m_bytesPerSecond;
+    VncSeries m_series[VncStats::PaintTime + 1];
+    qreal m_averages[VncStats::PaintTime + 1];
+    VncStats *q_ptr;
+};
+
+} // namespace
+
+VncStatsPrivate::VncStatsPrivate(VncStats *q):
+    m_logInterval(0),
+    m_frames(0),
+    m_droppedFrames(0),
+    m_tickFrames(0),
+    m_tickBytes(0),
+    m_fps(0),
+    m_bytesPerSecond(0),
+    q_ptr(q)
+{
+    std::fill(m_averages, m_averages + VncStats::PaintTime + 1, 0.0);
+    m_timer.setInterval(1000);
+    QObject::connect(&m_timer, &QTimer::timeout, q, [this]() { onTick(); });
+}
+
+const VncSeries &VncStatsPrivate::series(VncStats::Metric metric) const
+{
+    return m_series[qBound(0, int(metric), int(VncStats::PaintTime))];
+}
+
+qreal VncStatsPrivate::scale(VncStats::Metric metric)
+{
+    switch (metric) {
+    case VncStats::DecodeTime:
+    case VncStats::Latency:
+    case VncStats::PaintTime:
+        return 1e-6; // ns to ms
+    default:
+        return 1;
+    }
+}
+
+void VncStatsPrivate::onTick()
+{
+    Q_Q(VncStats);
+
+    qreal seconds = m_tickTimer.isValid() ?
+        m_tickTimer.restart() / 1000.0 : 0;
+    if (seconds > 0) {
+        m_fps = m_tickFrames / seconds;
+        m_bytesPerSecond = m_tickBytes / seconds;
+    }
+    for (int i = 0; i <= VncStats::PaintTime; i++) {
+        VncStats::Metric metric = VncStats::Metric(i);
+        m_averages[i] = m_series[i].average() * scale(metric);
+    }
+
+    if (m_logInterval > 0 && m_logTimer.isValid() &&
+        m_logTimer.elapsed() >= m_logInterval * 1000) {
+        m_logTimer.restart();
+        log();
+    }
+
+    /* Don't keep waking up when nothing is happening */
+    if (m_tickFrames == 0) {
+        m_timer.stop();
+        m_tickTimer.invalidate();
+    }
+    m_tickFrames = 0;
+    m_tickBytes = 0;
+
+    Q_EMIT q->updated();
+}
+
+void VncStatsPrivate::log() const
+{
+    Q_Q(const VncStats);
+
+    qDebug().nospace() << "VNC stats: " << m_frames << " frames (" <<
+        m_droppedFrames << " dropped), " << m_fps << " fps, " <<
+        m_bytesPerSecond / 1024 << " KiB/s, " <<
+        m_averages[VncStats::Rects] << " rects/frame (" <<
+        m_averages[VncStats::CopyRects] << " copy); " <<
+        "decode " << m_averages[VncStats::DecodeTime] << " ms (p95 " <<
+        q->percentile(VncStats::DecodeTime, 95) << "), " <<
+        "latency " << m_averages[VncStats::Latency] << " ms (p95 " <<
+        q->percentile(VncStats::Latency, 95) << "), " <<
+        "paint " << m_averages[VncStats::PaintTime] << " ms (p95 " <<
+        q->percentile(VncStats::PaintTime, 95) << ")";
+}
+
+VncStats::VncStats(QObject *parent):
+    QObject(parent),
+    d_ptr(new VncStatsPrivate(this))
+{
+}
+
+VncStats::~VncStats() = default;
+
+qint64 VncStats::timestamp()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+void VncStats::setLogInterval(int seconds)
+{
+    Q_D(VncStats);
+    seconds = qMax(seconds, 0);
+    if (seconds == d->m_logInterval) return;
+    d->m_logInterval = seconds;
+    if (seconds > 0) {
+        d->m_logTimer.start();
+    } else {
+        d->m_logTimer.invalidate();
+    }
+    Q_EMIT logIntervalChanged();
+}
+
+int VncStats::logInterval() const
+{
+    Q_D(const VncStats);
+    return d->m_logInterval;
+}
+
+quint64 VncStats::frames() const
+{
+    Q_D(const VncStats);
+    return d->m_frames;
+}
+
+quint64 VncStats::droppedFrames() const
+{
+    Q_D(const VncStats);
+    return d->m_droppedFrames;
+}
+
+qreal VncStats::fps() const
+{
+    Q_D(const VncStats);
+    return d->m_fps;
+}
+
+qreal VncStats::bytesPerSecond() const
+{
+    Q_D(const VncStats);
+    return d->m_bytesPerSecond;
+}
+
+qreal VncStats::bytesPerFrame() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[Bytes];
+}
+
+qreal VncStats::rectsPerFrame() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[Rects];
+}
+
+qreal VncStats::copyRectsPerFrame() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[CopyRects];
+}
+
+qreal VncStats::decodeTime() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[DecodeTime];
+}
+
+qreal VncStats::latency() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[Latency];
+}
+
+qreal VncStats::paintTime() const
+{
+    Q_D(const VncStats);
+    return d->m_averages[PaintTime];
+}
+
+qreal VncStats::average(Metric metric) const
+{
+    Q_D(const VncStats);
+    return d->series(metric).average() * d->scale(metric);
+}
+
+qreal VncStats::percentile(Metric metric, qreal p) const
+{
+    Q_D(const VncStats);
+    return d->series(metric).percentile(p) * d->scale(metric);
+}
+
+void VncStats::reset()
+{
+    Q_D(VncStats);
+    for (VncSeries &series: d->m_series) {
+        series.clear();
+    }
+    d->m_frames = d->m_droppedFrames = 0;
+    d->m_tickFrames = 0;
+    d->m_tickBytes = 0;
+    d->m_fps = d->m_bytesPerSecond = 0;
+    std::fill(d->m_averages, d->m_averages + PaintTime + 1, 0.0);
+    Q_EMIT updated();
+}
+
+void VncStats::addFrame(const VncFrameStats &frame)
+{
+    Q_D(VncStats);
+
+    d->m_frames++;
+    d->m_droppedFrames += frame.dropped;
+    d->m_tickFrames++;
+    d->m_tickBytes += frame.bytes;
+    d->m_series[Bytes].add(frame.bytes);
+    d->m_series[Rects].add(frame.rects);
+    d->m_series[CopyRects].add(frame.copyRects);
+    d->m_series[DecodeTime].add(frame.decodeTime);
+
+    if (!d->m_timer.isActive()) {
+        d->m_tickTimer.start();
+        d->m_timer.start();
+    }
+}
+
+void VncStats::addPaint(qint64 readableAt, qint64 paintTime)
+{
+    Q_D(VncStats);
+    if (readableAt > 0) {
+        d->m_series[Latency].add(timestamp() - readableAt);
+    }
+    d->m_series[PaintTime].add(paintTime);
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_VNC_STATS_H
+#define LOMIRIVNC_VNC_STATS_H
+
+#include <QObject>
+#include <QScopedPointer>
+
+namespace LomiriVNC {
+
+/* What went into one of the frames handed to the viewers. When a frame is
+ * dropped, because a newer one was published before the GUI could latch it,
+ * its figures are merged into the newer frame. */
+struct VncFrameStats {
+    VncFrameStats():
+        bytes(0), rects(0), copyRects(0), decodeTime(0), readableAt(0),
+        dropped(0) {}
+
+    void merge(const VncFrameStats &older) {
+        bytes += older.bytes;
+        rects += older.rects;
+        copyRects += older.copyRects;
+        decodeTime += older.decodeTime;
+        readableAt = older.readableAt;
+        dropped += older.dropped + 1;
+    }
+
+    qint64 bytes; // read from the socket; approximate
+    int rects;
+    int copyRects;
+    qint64 decodeTime; // ns
+    qint64 readableAt; // VncStats::timestamp() when reading started
+    int dropped;
+};
+
+class VncStatsPrivate;
+/* Rolling statistics over the most recent frames.
+ *
+ * Frames are added by VncClient when they are latched, and paint samples by
+ * VncOutput during the scene graph synchronization (when the GUI thread is
+ * blocked): no locking is needed. The properties are refreshed once per
+ * second, and only while frames are coming.
+ */
+class VncStats: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int logInterval READ logInterval WRITE setLogInterval
+               NOTIFY logIntervalChanged)
+    Q_PROPERTY(quint64 frames READ frames NOTIFY updated)
+    Q_PROPERTY(quint64 droppedFrames READ droppedFrames NOTIFY updated)
+    Q_PROPERTY(qreal fps READ fps NOTIFY updated)
+    Q_PROPERTY(qreal bytesPerSecond READ bytesPerSecond NOTIFY updated)
+    Q_PROPERTY(qreal bytesPerFrame READ bytesPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal rectsPerFrame READ rectsPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal copyRectsPerFrame READ copyRectsPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal decodeTime READ decodeTime NOTIFY updated)
+    Q_PROPERTY(qreal latency READ latency NOTIFY updated)
+    Q_PROPERTY(qreal paintTime READ paintTime NOTIFY updated)
+
+public:
+    enum Metric {
+        Bytes,
+        Rects,
+        CopyRects,
+        DecodeTime, // ms
+        Latency, // ms, from reading the first bytes of a frame to its upload
+        PaintTime, // ms
+    };
+    Q_ENUM(Metric)
+
+    VncStats(QObject *parent = nullptr);
+    virtual ~VncStats();
+
+    /* Nanoseconds on a monotonic clock shared by all threads */
+    static qint64 timestamp();
+
+    /* In seconds; if positive, a summary is logged at this interval */
+    void setLogInterval(int seconds);
+    int logInterval() const;
+
+    quint64 frames() const;
+    quint64 droppedFrames() const;
+    qreal fps() const;
+    qreal bytesPerSecond() const;
+
+    /* Averages over the window of recent frames */
+    qreal bytesPerFrame() const;
+    qreal rectsPerFrame() const;
+    qreal copyRectsPerFrame() const;
+    qreal decodeTime() const;
+    qreal latency() const;
+    qreal paintTime() const;
+
+    Q_INVOKABLE qreal average(Metric metric) const;
+    /* `p` ranges from 0 to 100 */
+    Q_INVOKABLE qreal percentile(Metric metric, qreal p) const;
+    Q_INVOKABLE void reset();
+
+    void addFrame(const VncFrameStats &frame);
+    void addPaint(qint64 readableAt, qint64 paintTime);
+
+Q_SIGNALS:
+    void logIntervalChanged();
+    void updated();
+
+private:
+    Q_DECLARE_PRIVATE(VncStats)
+    QScopedPointer<VncStatsPrivate> d_ptr;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_VNC_STATS_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_texture.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+using namespace LomiriVNC;
+
+/* Beyond this number of rectangles, a single upload of the bounding rectangle
+ * is cheaper than many small ones. */
+static const int maxUploadRects = 16;
+
+VncTexture::VncTexture():
+    QSGTexture(),
+    m_textureId(0),
+    m_format(QImage::Format_Invalid),
+    m_bindOptionsDirty(true)
+{
+}
+
+VncTexture::~VncTexture()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (m_textureId && context) {
+        context->functions()->glDeleteTextures(1, &m_textureId);
+    }
+}
+
+void VncTexture::upload(const QImage &image, const QRegion &damage)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (Q_UNLIKELY(!context)) {
+        qWarning() << "No current OpenGL context, cannot upload texture";
+        return;
+    }
+    QOpenGLFunctions *f = context->functions();
+
+    if (!m_textureId) {
+        f->glGenTextures(1, &m_textureId);
+        m_bindOptionsDirty = true;
+    }
+    f->glBindTexture(GL_TEXTURE_2D, m_textureId);
+
+    /* RGB565 frames can be uploaded as they are, at half the bandwidth;
+     * anything else is converted to RGBA. */
+    const bool isRgb565 = image.format() == QImage::Format_RGB16;
+    const GLenum format = isRgb565 ? GL_RGB : GL_RGBA;
+    const GLenum type = isRgb565 ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE;
+
+    QRegion region = damage.intersected(image.rect());
+    if (image.size() != m_size || image.format() != m_format) {
+        m_size = image.size();
+        m_format = image.format();
+        f->glTexImage2D(GL_TEXTURE_2D, 0, format,
+                        m_size.width(), m_size.height(), 0,
+                        format, type, nullptr);
+        region = image.rect();
+    }
+    if (region.rectCount() > maxUploadRects) {
+        region = region.boundingRect();
+    }
+
+    /* QImage lines are 32-bit aligned */
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    const int bytesPerPixel = image.depth() / 8;
+    for (const QRect &rect: region) {
+        /* Wrap the damaged area without copying it, and let the copy (or the
+         * conversion) produce a packed buffer in the expected byte order. */
+        const uchar *bits = image.constBits() +
+            rect.y() * image.bytesPerLine() + rect.x() * bytesPerPixel;
+        QImage tile(bits, rect.width(), rect.height(), image.bytesPerLine(),
+                    image.format());
+        tile = isRgb565 ? tile.copy() :
+            tile.convertToFormat(QImage::Format_RGBX8888);
+        f->glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(),
+                           rect.width(), rect.height(),
+                           format, type, tile.constBits());
+    }
+}
+
+int VncTexture::textureId() const
+{
+    return m_textureId;
+}
+
+QSize VncTexture::textureSize() const
+{
+    return m_size;
+}
+
+bool VncTexture::hasAlphaChannel() const
+{
+    return false;
+}
+
+bool VncTexture::hasMipmaps() const
+{
+    return false;
+}
+
+void VncTexture::bind()
+{
+    QOpenGLContext::currentContext()->functions()->
+        glBindTexture(GL_TEXTURE_2D, m_textureId);
+    updateBindOptions(m_bindOptionsDirty);
+    m_bindOptionsDirty = false;
+}
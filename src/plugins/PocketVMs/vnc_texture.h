@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_VNC_TEXTURE_H
+#define LOMIRIVNC_VNC_TEXTURE_H
+
+#include <QImage>
+#include <QRegion>
+#include <QSGTexture>
+#include <QSize>
+
+namespace LomiriVNC {
+
+/* An OpenGL texture holding a copy of the remote framebuffer.
+ *
+ * The texture storage is kept across frames, and only the damaged parts of
+ * the image are uploaded. upload() must be called from the scene graph
+ * synchronization phase (that is, from QQuickItem::updatePaintNode()), when
+ * the GUI thread is blocked and the OpenGL context is current.
+ */
+class VncTexture: public QSGTexture
+{
+    Q_OBJECT
+
+public:
+    VncTexture();
+    ~VncTexture();
+
+    void upload(const QImage &image, const QRegion &damage);
+
+    int textureId() const override;
+    QSize textureSize() const override;
+    bool hasAlphaChannel() const override;
+    bool hasMipmaps() const override;
+    void bind() override;
+
+private:
+    uint m_textureId;
+    QSize m_size;
+    QImage::Format m_format;
+    bool m_bindOptionsDirty;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_VNC_TEXTURE_H
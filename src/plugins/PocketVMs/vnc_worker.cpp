@@ -0,0 +1,893 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_worker.h"
+
+#include <QByteArrayList>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QVector>
+#include <QtEndian>
+#include <cstring>
+#include <sys/ioctl.h>
+
+using namespace LomiriVNC;
+
+/* The candidates for the automatic encoding selection. On the local socket
+ * to QEMU the bandwidth is almost free, so the cheapest encodings to decode
+ * are tried first. */
+static const char *const encodingCandidates[] = {
+    "copyrect raw",
+    "copyrect zlib raw",
+    "copyrect zrle raw",
+    "copyrect tight raw",
+};
+static const int encodingCandidateCount =
+    sizeof(encodingCandidates) / sizeof(encodingCandidates[0]);
+static const int trialFrameCount = 30;
+
+/* Protocol extensions which libvncclient doesn't implement; see the
+ * "ContinuousUpdates" and "Fence" sections of the community RFB
+ * specification. */
+static const int encodingContinuousUpdates = -313;
+static const int encodingFence = -312;
+/* EnableContinuousUpdates (client) and EndOfContinuousUpdates (server) */
+static const uint8_t messageContinuousUpdates = 150;
+static const uint8_t messageFence = 248;
+static const quint32 fenceBlockBefore = 1 << 0;
+static const quint32 fenceBlockAfter = 1 << 1;
+static const quint32 fenceSyncNext = 1 << 2;
+static const quint32 fenceRequest = 1u << 31;
+static const int fenceMaxPayload = 64;
+static const qint64 fenceInterval = 1000000000; // ns
+static const int handshakeTimeout = 10; // s
+
+VncWorker::VncWorker():
+    QObject(),
+    m_pacingTimer(new QTimer(this)),
+    m_minFrameInterval(0),
+    m_waitingForLatch(false),
+    m_updateFinished(false),
+    m_bytesPerPixel(4),
+    m_back(0),
+    m_pending(1),
+    m_front(2),
+    m_defaultGotCopyRect(nullptr),
+    m_client(nullptr),
+    m_defaultEncodings(nullptr),
+    m_updatesWanted(true),
+    m_continuousUpdatesSupported(false),
+    m_continuousUpdates(false),
+    m_fenceSupported(false),
+    m_fencePending(false),
+    m_lastFenceRequest(-1),
+    m_trialCandidate(-1),
+    m_trialFrames(0),
+    m_selectedCandidate(0)
+{
+    rfbClientLog = vncLog;
+    rfbClientErr = vncError;
+    registerProtocolExtension();
+
+    m_pacingTimer->setSingleShot(true);
+    QObject::connect(m_pacingTimer, &QTimer::timeout,
+                     this, [this]() { setReadingEnabled(true); });
+}
+
+VncWorker::~VncWorker()
+{
+    disconnect();
+}
+
+void *VncWorker::dataTag()
+{
+    return reinterpret_cast<void*>(dataTag);
+}
+
+void VncWorker::vncLog(const char *format, ...)
+{
+    va_list args;
+	va_start(args, format);
+    QString message = QString::vasprintf(format, args);
+	va_end(args);
+
+    qDebug() << "VNC:" << message.trimmed();
+}
+
+void VncWorker::vncError(const char *format, ...)
+{
+    va_list args;
+	va_start(args, format);
+    QString message = QString::vasprintf(format, args);
+	va_end(args);
+
+    qWarning() << "VNC:" << message.trimmed();
+}
+
+void VncWorker::gotFrameBufferUpdate(rfbClient *client,
+                                     int x, int y, int w, int h)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    static_cast<VncWorker*>(ptr)->onUpdate(x, y, w, h);
+}
+
+void VncWorker::finishedFrameBufferUpdate(rfbClient *client)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    static_cast<VncWorker*>(ptr)->onUpdateFinished();
+}
+
+char *VncWorker::GetPassword(rfbClient *client)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    return static_cast<VncWorker*>(ptr)->getPassword();
+}
+
+rfbBool VncWorker::mallocFrameBuffer(rfbClient* client)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    static_cast<VncWorker*>(ptr)->onResize();
+    return true;
+}
+
+void VncWorker::gotCopyRect(rfbClient *client, int srcX, int srcY,
+                            int w, int h, int destX, int destY)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    VncWorker *worker = static_cast<VncWorker*>(ptr);
+    worker->m_frameStats.copyRects++;
+    worker->m_defaultGotCopyRect(client, srcX, srcY, w, h, destX, destY);
+}
+
+void VncWorker::gotCursorShape(rfbClient *client, int xHot, int yHot,
+                               int width, int height, int bytesPerPixel)
+{
+    Q_UNUSED(bytesPerPixel); // always ours
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    static_cast<VncWorker*>(ptr)->onCursorShape(QPoint(xHot, yHot),
+                                                QSize(width, height));
+}
+
+rfbBool VncWorker::handleServerMessage(rfbClient *client,
+                                      rfbServerToClientMsg *message)
+{
+    void *ptr = rfbClientGetClientData(client, dataTag());
+    return static_cast<VncWorker*>(ptr)->onServerMessage(message->type);
+}
+
+void VncWorker::registerProtocolExtension()
+{
+    /* The extension list of libvncclient is global: register only once */
+    static int encodings[] = {
+        encodingContinuousUpdates, encodingFence, 0
+    };
+    static rfbClientProtocolExtension extension;
+    if (extension.encodings) return;
+
+    extension.encodings = encodings;
+    extension.handleMessage = handleServerMessage;
+    rfbClientRegisterExtension(&extension);
+}
+
+void VncWorker::onUpdate(int x, int y, int w, int h)
+{
+    /* A single FramebufferUpdate message can carry many rectangles: collect
+     * them, and publish the frame only once the whole message has been
+     * processed. */
+    m_damage += QRect(x, y, w, h);
+    m_frameStats.rects++;
+}
+
+void VncWorker::onUpdateFinished()
+{
+    /* The frame is published by onSocketActivated(), once the cost of the
+     * whole message is known */
+    m_updateFinished = true;
+}
+
+void VncWorker::publishFrame()
+{
+    if (m_trialCandidate >= 0) {
+        qint64 pixels = 0;
+        for (const QRect &rect: m_damage) {
+            pixels += qint64(rect.width()) * rect.height();
+        }
+        sampleEncodingCost(m_frameStats.decodeTime, pixels);
+    }
+
+    const int published = m_back;
+    VncBuffer &current = m_buffers[published];
+    for (int i = 0; i < 3; i++) {
+        if (i != published) m_buffers[i].stale += m_damage;
+    }
+
+    /* If the pending buffer has not been picked up by the GUI thread, we are
+     * going to take it back: its damage must then be carried over to the
+     * frame we publish. */
+    int expected = m_pending.load(std::memory_order_acquire);
+    do {
+        current.damage = m_damage;
+        current.stats = m_frameStats;
+        if (expected & FreshFrame) {
+            const VncBuffer &dropped = m_buffers[expected & IndexMask];
+            current.damage += dropped.damage;
+            current.stats.merge(dropped.stats);
+        }
+    } while (!m_pending.compare_exchange_weak(expected,
+                                              published | FreshFrame,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_acquire));
+    m_back = expected & IndexMask;
+    m_damage = QRegion();
+    m_frameStats = VncFrameStats();
+
+    prepareBackBuffer(published);
+
+    /* Hold on until this frame has been latched by the GUI */
+    m_waitingForLatch = true;
+    m_frameTimer.start();
+    setReadingEnabled(false);
+
+    Q_EMIT frameReady();
+}
+
+void VncWorker::setMaxFps(int fps)
+{
+    m_minFrameInterval = fps > 0 ? 1000 / fps : 0;
+    scheduleReading();
+}
+
+void VncWorker::frameLatched()
+{
+    m_waitingForLatch = false;
+    requestRoundTrip();
+    scheduleReading();
+}
+
+void VncWorker::setUpdatesWanted(bool wanted)
+{
+    if (wanted == m_updatesWanted) return;
+    m_updatesWanted = wanted;
+    if (!m_client) return;
+
+    qDebug() << (wanted ? "Resuming" : "Pausing") << "framebuffer updates";
+    if (m_continuousUpdates != wanted) {
+        enableContinuousUpdates(wanted);
+    }
+
+    if (wanted) {
+        /* Whatever happened while we were not looking has not been
+         * decoded: ask for the whole framebuffer */
+        bool ok = SendFramebufferUpdateRequest(m_client, 0, 0,
+                                               m_client->width,
+                                               m_client->height, FALSE);
+        if (Q_UNLIKELY(!ok)) {
+            qWarning() << "Could not request a full update";
+        }
+        scheduleReading();
+    } else {
+        /* Without reading, no further update requests are sent by
+         * libvncclient, and the server stops sending updates */
+        m_pacingTimer->stop();
+        setReadingEnabled(false);
+    }
+}
+
+void VncWorker::scheduleReading()
+{
+    if (!m_notifier || m_waitingForLatch || !m_updatesWanted) return;
+
+    qint64 remaining = m_frameTimer.isValid() ?
+        m_minFrameInterval - m_frameTimer.elapsed() : 0;
+    if (remaining > 0) {
+        m_pacingTimer->start(remaining);
+    } else {
+        m_pacingTimer->stop();
+        setReadingEnabled(true);
+    }
+}
+
+void VncWorker::setReadingEnabled(bool enabled)
+{
+    if (!m_notifier) return;
+
+    m_notifier->setEnabled(enabled);
+    /* libvncclient reads ahead into its own buffer: if a message is already
+     * there, the socket won't tell us */
+    if (enabled && m_client->buffered > 0) {
+        QMetaObject::invokeMethod(this, [this]() {
+            if (m_notifier && m_notifier->isEnabled()) onSocketActivated();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void VncWorker::prepareBackBuffer(int source)
+{
+    VncBuffer &back = m_buffers[m_back];
+    const QImage &sourceImage = m_buffers[source].image;
+
+    if (back.image.size() != sourceImage.size() ||
+        back.image.format() != sourceImage.format()) {
+        allocateBuffer(&back, sourceImage.size());
+        back.stale = sourceImage.rect();
+    }
+
+    /* Bring the new back buffer up to date, by copying forward only the
+     * areas which changed since it was last used. The source buffer may be
+     * read by the GUI thread at the same time, but nobody writes it. */
+    const int bytesPerLine = sourceImage.bytesPerLine();
+    for (const QRect &rect: back.stale) {
+        const int offset = rect.x() * m_bytesPerPixel;
+        const int length = rect.width() * m_bytesPerPixel;
+        for (int y = rect.top(); y <= rect.bottom(); y++) {
+            memcpy(back.storage.data() + y * bytesPerLine + offset,
+                   sourceImage.constScanLine(y) + offset, length);
+        }
+    }
+    back.stale = QRegion();
+
+    m_client->frameBuffer = back.storage.data();
+}
+
+void VncWorker::allocateBuffer(VncBuffer *buffer, const QSize &size)
+{
+    const int bytesPerLine = size.width() * m_bytesPerPixel;
+    const size_t needed = size_t(bytesPerLine) * size.height();
+    if (buffer->storage.size() < needed) {
+        buffer->storage.resize(needed);
+    }
+    buffer->image = QImage(buffer->storage.data(),
+                           size.width(), size.height(), bytesPerLine,
+                           imageFormat());
+    buffer->stale = QRegion();
+    buffer->damage = QRegion();
+}
+
+QImage::Format VncWorker::imageFormat() const
+{
+    return m_bytesPerPixel == 2 ? QImage::Format_RGB16 : QImage::Format_RGB32;
+}
+
+bool VncWorker::swapFrontBuffer()
+{
+    if (!(m_pending.load(std::memory_order_acquire) & FreshFrame)) {
+        return false;
+    }
+    int pending = m_pending.exchange(m_front, std::memory_order_acq_rel);
+    m_front = pending & IndexMask;
+    return true;
+}
+
+const QImage &VncWorker::frontImage() const
+{
+    return m_buffers[m_front].image;
+}
+
+const QRegion &VncWorker::frontDamage() const
+{
+    return m_buffers[m_front].damage;
+}
+
+const VncFrameStats &VncWorker::frontStats() const
+{
+    return m_buffers[m_front].stats;
+}
+
+void VncWorker::onResize()
+{
+    int width = m_client->width;
+    int height = m_client->height;
+    qDebug() << Q_FUNC_INFO << width << height;
+
+    m_client->updateRect.x = m_client->updateRect.y = 0;
+    m_client->updateRect.w = width;
+    m_client->updateRect.h = height;
+
+    /* Only the back buffer is reallocated now: the other two might be in use
+     * by the GUI thread, and will be resized when they get their turn. The
+     * storage itself only grows, so shrinking, or going back to a previous
+     * size, doesn't allocate. */
+    VncBuffer &back = m_buffers[m_back];
+    const QSize size(width, height);
+    const bool changed = back.image.size() != size ||
+        back.image.format() != imageFormat();
+    m_damage = QRegion();
+    if (changed) {
+        allocateBuffer(&back, size);
+    }
+    m_client->frameBuffer = back.storage.data();
+    m_client->width = back.image.bytesPerLine() / m_bytesPerPixel;
+    m_client->format.bitsPerPixel = back.image.depth();
+    if (m_bytesPerPixel == 2) {
+        /* RGB565, matching QImage::Format_RGB16 */
+        m_client->format.depth=16;
+        m_client->format.redShift=11;
+        m_client->format.greenShift=5;
+        m_client->format.blueShift=0;
+        m_client->format.redMax=0x1f;
+        m_client->format.greenMax=0x3f;
+        m_client->format.blueMax=0x1f;
+    } else {
+        m_client->format.redShift=16;
+        m_client->format.greenShift=8;
+        m_client->format.blueShift=0;
+        m_client->format.redMax=0xff;
+        m_client->format.greenMax=0xff;
+        m_client->format.blueMax=0xff;
+    }
+    m_client->canHandleNewFBSize=true;
+
+    /* The area of the continuous updates must follow the new size */
+    if (m_continuousUpdates) {
+        enableContinuousUpdates(true);
+    }
+
+    /* A different geometry can favour a different encoding */
+    if (m_settings.automatic && changed) {
+        restartEncodingTrial();
+    }
+    applyEncodings();
+}
+
+void VncWorker::onCursorShape(const QPoint &hotspot, const QSize &size)
+{
+    if (size.isEmpty() || !m_client->rcSource || !m_client->rcMask) {
+        Q_EMIT cursorChanged(QImage(), QPoint());
+        return;
+    }
+
+    /* The pixels come in our framebuffer format, and the mask has one byte
+     * per pixel */
+    QImage source(m_client->rcSource, size.width(), size.height(),
+                  size.width() * m_bytesPerPixel, imageFormat());
+    QImage cursor = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const uint8_t *mask = m_client->rcMask;
+    for (int y = 0; y < cursor.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(cursor.scanLine(y));
+        for (int x = 0; x < cursor.width(); x++) {
+            line[x] = *mask++ ? (line[x] | 0xff000000) : 0;
+        }
+    }
+    Q_EMIT cursorChanged(cursor, hotspot);
+}
+
+void VncWorker::requestDesktopSize(const QSize &size)
+{
+    m_desiredDesktopSize = size;
+    sendDesktopSize();
+}
+
+void VncWorker::sendDesktopSize()
+{
+    if (!m_client || m_desiredDesktopSize.isEmpty()) return;
+    if (m_desiredDesktopSize == m_buffers[m_back].image.size()) return;
+
+#ifdef HAVE_SEND_EXT_DESKTOP_SIZE
+    qDebug() << "Requesting desktop size" << m_desiredDesktopSize;
+    bool ok = SendExtDesktopSize(m_client, m_desiredDesktopSize.width(),
+                                 m_desiredDesktopSize.height());
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "Could not request the desktop size";
+    }
+#else
+    static bool warned = false;
+    if (!warned) {
+        qWarning() << "libvncclient doesn't support SetDesktopSize";
+        warned = true;
+    }
+#endif
+}
+
+void VncWorker::setEncodingSettings(const VncEncodingSettings &settings)
+{
+    m_settings = settings;
+    if (!m_client) return;
+
+    if (m_settings.automatic) {
+        restartEncodingTrial();
+    } else {
+        m_trialCandidate = -1;
+    }
+    applyEncodings();
+}
+
+void VncWorker::applyEncodings()
+{
+    QByteArray encodings = m_settings.encodings;
+    if (m_settings.automatic) {
+        int candidate = m_trialCandidate < encodingCandidateCount ?
+            m_trialCandidate : m_selectedCandidate;
+        encodings = encodingCandidates[qMax(candidate, 0)];
+    }
+
+    /* libvncclient keeps a pointer to the string */
+    m_activeEncodings = encodings;
+    m_client->appData.encodingsString = m_activeEncodings.isEmpty() ?
+        m_defaultEncodings : m_activeEncodings.constData();
+    m_client->appData.compressLevel = qBound(0, m_settings.compressLevel, 9);
+    m_client->appData.qualityLevel = qBound(0, m_settings.qualityLevel, 9);
+
+    bool ok = SetFormatAndEncodings(m_client);
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "Could not set format to server";
+    }
+    Q_EMIT activeEncodingsChanged(
+        QString::fromLatin1(m_client->appData.encodingsString));
+}
+
+void VncWorker::restartEncodingTrial()
+{
+    m_trialCandidate = 0;
+    m_trialFrames = 0;
+    m_trialTime.fill(0, encodingCandidateCount);
+    m_trialPixels.fill(0, encodingCandidateCount);
+}
+
+void VncWorker::sampleEncodingCost(qint64 nsecs, qint64 pixels)
+{
+    if (m_trialCandidate >= encodingCandidateCount) return; // trial is over
+
+    /* The first frame after switching encodings is usually a big one, with
+     * data requested under the previous settings: don't count it. */
+    if (m_trialFrames++ > 0) {
+        m_trialTime[m_trialCandidate] += nsecs;
+        m_trialPixels[m_trialCandidate] += pixels;
+    }
+    if (m_trialFrames <= trialFrameCount) return;
+
+    m_trialFrames = 0;
+    if (++m_trialCandidate < encodingCandidateCount) {
+        applyEncodings();
+        return;
+    }
+
+    int best = 0;
+    double bestCost = -1;
+    for (int i = 0; i < encodingCandidateCount; i++) {
+        if (m_trialPixels[i] == 0) continue;
+        double cost = double(m_trialTime[i]) / m_trialPixels[i];
+        qDebug() << "Encoding" << encodingCandidates[i] <<
+            "costs" << cost << "ns per pixel";
+        if (bestCost < 0 || cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    /* The trial index stays past the end, so that sampling stops */
+    m_selectedCandidate = best;
+    applyEncodings();
+}
+
+char *VncWorker::getPassword()
+{
+	return strdup(m_password.toUtf8().constData());
+}
+
+bool VncWorker::connectToServer(const QString &host, const QString &password)
+{
+    if (m_client) {
+        disconnect();
+    }
+
+    m_password = QString(password);
+
+    m_bytesPerPixel = m_settings.pixelDepth == 16 ? 2 : 4;
+    m_client = rfbGetClient(m_bytesPerPixel == 2 ? 5 : 8, 3, m_bytesPerPixel);
+    m_defaultEncodings = m_client->appData.encodingsString;
+    m_trialCandidate = -1;
+    m_frameStats = VncFrameStats();
+    m_updateFinished = false;
+    m_waitingForLatch = false;
+    m_frameTimer.invalidate();
+    m_continuousUpdatesSupported = false;
+    m_continuousUpdates = false;
+    m_fenceSupported = false;
+    m_fencePending = false;
+    m_lastFenceRequest = -1;
+    m_connectionTimer.start();
+    m_client->MallocFrameBuffer = mallocFrameBuffer;
+    m_client->GotFrameBufferUpdate = gotFrameBufferUpdate;
+    m_client->FinishedFrameBufferUpdate = finishedFrameBufferUpdate;
+    m_client->GetPassword = GetPassword;
+    m_defaultGotCopyRect = m_client->GotCopyRect;
+    m_client->GotCopyRect = gotCopyRect;
+    m_client->GotCursorShape = gotCursorShape;
+    m_client->appData.useRemoteCursor = TRUE;
+    rfbClientSetClientData(m_client, dataTag(), this);
+
+    QByteArrayList arguments = {
+        "lomiri-vnc",
+    };
+    arguments.append(host.toUtf8());
+    int argc = arguments.count();
+    QVector<char *> argv;
+    argv.reserve(argc + 1);
+    for (const QByteArray &a: arguments) {
+        argv.append((char*)a.constData());
+    }
+    argv.append(nullptr);
+
+#if defined(HAVE_RFB_CONNECT_TIMEOUT) && defined(HAVE_RFB_READ_TIMEOUT)
+    /* The GUI doesn't wait for the handshake, but whatever it asks next is
+     * queued behind it: don't let an unresponsive server hold the thread */
+    m_client->connectTimeout = handshakeTimeout;
+    m_client->readTimeout = handshakeTimeout;
+#endif
+
+    bool ok = rfbInitClient(m_client, &argc, argv.data());
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "Could not initialize rfbClient";
+        m_client = nullptr;
+        return false;
+    }
+#ifdef HAVE_RFB_READ_TIMEOUT
+    /* From now on the socket is only read when it's readable */
+    m_client->readTimeout = DEFAULT_READ_TIMEOUT;
+#endif
+
+    m_notifier.reset(new QSocketNotifier(m_client->sock,
+                                         QSocketNotifier::Read));
+    QObject::connect(m_notifier.data(), &QSocketNotifier::activated,
+                     this, [this]() { onSocketActivated(); });
+    sendDesktopSize();
+    if (!m_updatesWanted) {
+        setReadingEnabled(false);
+    }
+    return true;
+}
+
+void VncWorker::disconnect()
+{
+    m_pacingTimer->stop();
+    m_waitingForLatch = false;
+    m_notifier.reset();
+    if (m_client) {
+        rfbClientCleanup(m_client);
+        m_client = nullptr;
+    }
+    m_damage = QRegion();
+    m_outgoing.clear();
+    if (m_continuousUpdates) {
+        m_continuousUpdates = false;
+        Q_EMIT continuousUpdatesChanged(false);
+    }
+}
+
+static int bytesAvailable(int socket)
+{
+    int bytes = 0;
+    return ioctl(socket, FIONREAD, &bytes) == 0 ? bytes : 0;
+}
+
+void VncWorker::onSocketActivated()
+{
+    if (m_frameStats.readableAt == 0) {
+        m_frameStats.readableAt = VncStats::timestamp();
+    }
+    /* libvncclient doesn't count the bytes it reads: estimate them from
+     * how much the socket queue has been drained */
+    const int socket = m_client->sock;
+    const int queuedBefore = bytesAvailable(socket);
+
+    QElapsedTimer timer;
+    timer.start();
+    m_updateFinished = false;
+    bool ok = HandleRFBServerMessage(m_client);
+    m_frameStats.decodeTime += timer.nsecsElapsed();
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "RFB failed to handle message";
+        disconnect();
+        Q_EMIT disconnected();
+        return;
+    }
+    m_frameStats.bytes += qMax(queuedBefore - bytesAvailable(socket), 0);
+
+    /* Only a FramebufferUpdate with some damage makes a frame: anything else
+     * (fence messages, bells, cut text, empty incremental updates) must
+     * neither start the latency clock of the next frame nor add to its
+     * costs */
+    if (m_updateFinished && !m_damage.isEmpty()) {
+        publishFrame();
+    } else {
+        m_damage = QRegion();
+        m_frameStats = VncFrameStats();
+    }
+}
+
+void VncWorker::sendKeyEvents(const QVector<VncKeyEvent> &events)
+{
+    if (Q_UNLIKELY(!m_client) || m_client->appData.viewOnly) return;
+
+    for (const VncKeyEvent &event: events) {
+        rfbKeyEventMsg msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.type = rfbKeyEvent;
+        msg.down = event.pressed ? 1 : 0;
+        msg.key = rfbClientSwap32IfLE(event.keysym);
+        queueMessage(&msg, sz_rfbKeyEventMsg);
+    }
+}
+
+void VncWorker::sendPointerEvents(const QVector<VncPointerEvent> &events)
+{
+    if (Q_UNLIKELY(!m_client) || m_client->appData.viewOnly) return;
+
+    for (const VncPointerEvent &event: events) {
+        rfbPointerEventMsg msg;
+        msg.type = rfbPointerEvent;
+        msg.buttonMask = event.buttonMask;
+        msg.x = rfbClientSwap16IfLE(qMax(event.x, 0));
+        msg.y = rfbClientSwap16IfLE(qMax(event.y, 0));
+        queueMessage(&msg, sz_rfbPointerEventMsg);
+    }
+}
+
+void VncWorker::queueMessage(const void *message, int length)
+{
+    if (m_outgoing.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this]() { flushOutgoing(); },
+                                  Qt::QueuedConnection);
+    }
+    m_outgoing.append(static_cast<const char *>(message), length);
+}
+
+void VncWorker::flushOutgoing()
+{
+    if (m_outgoing.isEmpty() || !m_client) return;
+
+    bool ok = WriteToRFBServer(m_client, m_outgoing.data(), m_outgoing.size());
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "Could not send input events";
+    }
+    m_outgoing.clear();
+}
+
+bool VncWorker::writeMessage(const QByteArray &message)
+{
+    /* Preserve the ordering with the buffered events */
+    flushOutgoing();
+
+    bool ok = WriteToRFBServer(m_client, const_cast<char*>(message.constData()),
+                               message.size());
+    if (Q_UNLIKELY(!ok)) {
+        qWarning() << "Could not send message" << int(message.at(0));
+    }
+    return ok;
+}
+
+bool VncWorker::onServerMessage(int type)
+{
+    switch (type) {
+    case messageContinuousUpdates:
+        onEndOfContinuousUpdates();
+        return true;
+    case messageFence:
+        return onFence();
+    default:
+        return false;
+    }
+}
+
+void VncWorker::onEndOfContinuousUpdates()
+{
+    /* The server sends this once as an acknowledgement of the pseudo
+     * encoding, and then every time continuous updates get disabled. */
+    if (!m_continuousUpdatesSupported) {
+        qDebug() << "Server supports continuous updates";
+        m_continuousUpdatesSupported = true;
+    }
+    if (m_continuousUpdates) {
+        m_continuousUpdates = false;
+        Q_EMIT continuousUpdatesChanged(false);
+    }
+    if (m_updatesWanted) {
+        enableContinuousUpdates(true);
+    }
+}
+
+void VncWorker::enableContinuousUpdates(bool enable)
+{
+    if (!m_continuousUpdatesSupported) return;
+
+    QByteArray message(10, '\0');
+    uchar *data = reinterpret_cast<uchar*>(message.data());
+    data[0] = messageContinuousUpdates;
+    data[1] = enable ? 1 : 0;
+    qToBigEndian<quint16>(0, data + 2);
+    qToBigEndian<quint16>(0, data + 4);
+    qToBigEndian<quint16>(m_client->width, data + 6);
+    qToBigEndian<quint16>(m_client->height, data + 8);
+    if (!writeMessage(message)) return;
+
+    /* When disabling, the server acknowledges with EndOfContinuousUpdates;
+     * the classic request/response flow of libvncclient then takes over */
+    if (enable != m_continuousUpdates) {
+        m_continuousUpdates = enable;
+        Q_EMIT continuousUpdatesChanged(enable);
+    }
+}
+
+bool VncWorker::onFence()
+{
+    char header[8]; // padding, flags and payload length
+    if (!ReadFromRFBServer(m_client, header, sizeof(header))) return false;
+
+    const quint32 flags =
+        qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(header + 3));
+    const int length = uchar(header[7]);
+    if (Q_UNLIKELY(length > fenceMaxPayload)) {
+        qWarning() << "Invalid fence payload length" << length;
+        return false;
+    }
+    QByteArray payload(length, '\0');
+    if (length > 0 &&
+        !ReadFromRFBServer(m_client, payload.data(), length)) return false;
+
+    /* The server starts by sending us a fence request: only after that are
+     * we allowed to send our own. */
+    m_fenceSupported = true;
+
+    if (flags & fenceRequest) {
+        /* Messages are processed in order, and the response is sent right
+         * away: the synchronization flags are trivially satisfied */
+        return sendFence(flags &
+                         (fenceBlockBefore | fenceBlockAfter | fenceSyncNext),
+                         payload);
+    }
+
+    /* A response to one of our requests, carrying the time it was sent */
+    if (m_fencePending && payload.size() == int(sizeof(qint64))) {
+        m_fencePending = false;
+        const qint64 sent =
+            qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(
+                payload.constData()));
+        Q_EMIT roundTripTimeMeasured(
+            (m_connectionTimer.nsecsElapsed() - sent) / 1000);
+    }
+    return true;
+}
+
+bool VncWorker::sendFence(quint32 flags, const QByteArray &payload)
+{
+    QByteArray message(9, '\0');
+    uchar *data = reinterpret_cast<uchar*>(message.data());
+    data[0] = messageFence;
+    qToBigEndian<quint32>(flags, data + 4);
+    data[8] = uchar(payload.size());
+    message.append(payload);
+    return writeMessage(message);
+}
+
+void VncWorker::requestRoundTrip()
+{
+    if (!m_client || !m_fenceSupported || m_fencePending) return;
+
+    const qint64 now = m_connectionTimer.nsecsElapsed();
+    if (m_lastFenceRequest >= 0 &&
+        now - m_lastFenceRequest < fenceInterval) return;
+
+    /* BlockBefore: the response comes only once the server has processed
+     * everything we sent before, input events included */
+    QByteArray payload(sizeof(qint64), '\0');
+    qToBigEndian<qint64>(now, reinterpret_cast<uchar*>(payload.data()));
+    m_fencePending = sendFence(fenceRequest | fenceBlockBefore, payload);
+    m_lastFenceRequest = now;
+}
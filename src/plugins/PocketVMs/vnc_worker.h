@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOMIRIVNC_VNC_WORKER_H
+#define LOMIRIVNC_VNC_WORKER_H
+
+#include "vnc_stats.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+#include <QPoint>
+#include <QRect>
+#include <QRegion>
+#include <QScopedPointer>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <vector>
+#define XK_CYRILLIC
+#include <rfb/rfbclient.h>
+
+class QSocketNotifier;
+class QTimer;
+
+namespace LomiriVNC {
+
+struct VncPointerEvent {
+    int x;
+    int y;
+    int buttonMask;
+};
+
+struct VncKeyEvent {
+    uint32_t keysym;
+    bool pressed;
+};
+
+struct VncEncodingSettings {
+    VncEncodingSettings():
+        compressLevel(3), qualityLevel(5), pixelDepth(32), automatic(false) {}
+
+    QByteArray encodings; // empty for the libvncclient defaults
+    int compressLevel;
+    int qualityLevel;
+    int pixelDepth; // 16 (RGB565) or 32 (RGB32); applied when connecting
+    bool automatic;
+};
+
+/* One of the three framebuffers. The image wraps `storage`, which is only
+ * ever written by the worker, and only while the buffer is the back buffer.
+ */
+struct VncBuffer {
+    std::vector<uchar> storage;
+    QImage image;
+    /* Areas which changed since this buffer was last up to date; only
+     * accessed by the worker */
+    QRegion stale;
+    /* Areas which changed since the frame the GUI thread saw last; written
+     * by the worker before the buffer is published */
+    QRegion damage;
+    VncFrameStats stats;
+};
+
+/* Owns the rfbClient and runs all the RFB protocol handling in the thread
+ * the object has been moved to.
+ *
+ * Frames are triple-buffered: libvncclient decodes into the back buffer, and
+ * at the end of each FramebufferUpdate message the back buffer is atomically
+ * exchanged with the pending one. The GUI thread, in turn, exchanges the
+ * pending buffer with its front buffer when it wants to show a new frame, so
+ * neither side ever waits for the other.
+ *
+ * Decoding is paced by the GUI: once a frame has been published, the socket
+ * is not read again until the GUI thread has latched that frame (and, if a
+ * maximum frame rate is set, until the frame interval has elapsed), so that
+ * we never decode frames which would not be shown. While no viewer is
+ * visible, reading stops altogether.
+ *
+ * If the server supports the ContinuousUpdates extension, the server pushes
+ * updates as soon as the framebuffer changes, instead of waiting for our
+ * requests; if it supports the Fence extension, fences are used to measure
+ * the round-trip time. Without them, the classic request/response flow of
+ * libvncclient is used.
+ *
+ * The cursor is requested as a separate sprite (the RichCursor and XCursor
+ * pseudo-encodings), so that the server leaves it out of the framebuffer
+ * and pointer motion alone doesn't cause any update; see cursorChanged().
+ *
+ * All methods except swapFrontBuffer() and the front*() getters must be
+ * invoked in the worker thread; those are for the GUI thread.
+ */
+class VncWorker: public QObject
+{
+    Q_OBJECT
+
+public:
+    VncWorker();
+    ~VncWorker();
+
+    bool connectToServer(const QString &host, const QString &password);
+    void disconnect();
+
+    void setEncodingSettings(const VncEncodingSettings &settings);
+    void setMaxFps(int fps);
+    void frameLatched();
+    /* Whether somebody is looking at the framebuffer. If not, the socket is
+     * not read (so no updates are requested nor decoded) and continuous
+     * updates are disabled; when resuming, a full update is requested. */
+    void setUpdatesWanted(bool wanted);
+    /* Asks the server to resize the desktop, with the SetDesktopSize
+     * message of the ExtendedDesktopSize extension; the request is repeated
+     * on the next connections, until an empty size is given. */
+    void requestDesktopSize(const QSize &size);
+
+    /* The events are buffered, and written to the socket in a single call
+     * when control returns to the event loop. */
+    void sendKeyEvents(const QVector<VncKeyEvent> &events);
+    void sendPointerEvents(const QVector<VncPointerEvent> &events);
+
+    /* If a new frame has been published, make it the front buffer and
+     * return true. */
+    bool swapFrontBuffer();
+    const QImage &frontImage() const;
+    const QRegion &frontDamage() const;
+    const VncFrameStats &frontStats() const;
+
+Q_SIGNALS:
+    void frameReady();
+    void disconnected();
+    void activeEncodingsChanged(const QString &encodings);
+    void continuousUpdatesChanged(bool active);
+    void roundTripTimeMeasured(qint64 usecs);
+    /* The image is ARGB32 premultiplied, or null if the server wants no
+     * cursor to be shown */
+    void cursorChanged(const QImage &image, const QPoint &hotspot);
+
+private:
+    static void *dataTag();
+    static void vncLog(const char *format, ...);
+    static void vncError(const char *format, ...);
+    static void gotFrameBufferUpdate(rfbClient *cl,
+                                     int x, int y, int w, int h);
+    static void finishedFrameBufferUpdate(rfbClient *cl);
+    static char *GetPassword(rfbClient *cl);
+    static rfbBool mallocFrameBuffer(rfbClient* client);
+    static void gotCopyRect(rfbClient *client, int srcX, int srcY,
+                            int w, int h, int destX, int destY);
+    static void gotCursorShape(rfbClient *client, int xHot, int yHot,
+                               int width, int height, int bytesPerPixel);
+    static rfbBool handleServerMessage(rfbClient *client,
+                                       rfbServerToClientMsg *message);
+    static void registerProtocolExtension();
+
+    void onUpdate(int x, int y, int w, int h);
+    void onUpdateFinished();
+    void publishFrame();
+    void onResize();
+    void onCursorShape(const QPoint &hotspot, const QSize &size);
+    char *getPassword();
+    void onSocketActivated();
+    void setReadingEnabled(bool enabled);
+    void queueMessage(const void *message, int length);
+    void flushOutgoing();
+    bool writeMessage(const QByteArray &message);
+    bool onServerMessage(int type);
+    void onEndOfContinuousUpdates();
+    bool onFence();
+    void enableContinuousUpdates(bool enable);
+    bool sendFence(quint32 flags, const QByteArray &payload);
+    void requestRoundTrip();
+    void sendDesktopSize();
+    void scheduleReading();
+    void allocateBuffer(VncBuffer *buffer, const QSize &size);
+    void prepareBackBuffer(int source);
+    QImage::Format imageFormat() const;
+    void applyEncodings();
+    void sampleEncodingCost(qint64 nsecs, qint64 pixels);
+    void restartEncodingTrial();
+
+private:
+    enum {
+        IndexMask = 0x3,
+        FreshFrame = 0x4, // the pending buffer hasn't been seen by the GUI
+    };
+
+    QScopedPointer<QSocketNotifier> m_notifier;
+    QTimer *m_pacingTimer;
+    QElapsedTimer m_frameTimer;
+    int m_minFrameInterval; // ms
+    bool m_waitingForLatch;
+    bool m_updateFinished; // by the message being handled
+    int m_bytesPerPixel;
+    VncBuffer m_buffers[3];
+    int m_back;
+    std::atomic<int> m_pending;
+    int m_front; // owned by the GUI thread
+    QRegion m_damage;
+    VncFrameStats m_frameStats; // of the frame being decoded
+    GotCopyRectProc m_defaultGotCopyRect;
+    QByteArray m_outgoing;
+    QString m_password;
+    rfbClient *m_client;
+    char *m_defaultEncodings;
+    VncEncodingSettings m_settings;
+    QByteArray m_activeEncodings;
+    bool m_updatesWanted;
+    bool m_continuousUpdatesSupported;
+    bool m_continuousUpdates;
+    bool m_fenceSupported;
+    bool m_fencePending;
+    qint64 m_lastFenceRequest; // ns since the connection, or -1
+    QElapsedTimer m_connectionTimer;
+    QSize m_desiredDesktopSize;
+    /* Automatic encoding selection: each candidate is tried for a number of
+     * frames, and the one with the lowest decoding time per pixel wins. */
+    int m_trialCandidate;
+    int m_trialFrames;
+    int m_selectedCandidate;
+    QVector<qint64> m_trialTime;
+    QVector<qint64> m_trialPixels;
+};
+
+} // namespace
+
+#endif // LOMIRIVNC_VNC_WORKER_H
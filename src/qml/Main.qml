@@ -73,6 +73,7 @@ MainView {
             }
         }
         runningMachineRefs.push({key: machine.storage, value: machine})
+        updateShownMachines()
     }
     function unregisterMachine(machine) {
         for (var i = 0; i < runningMachineRefs.length; i++) {
@@ -81,9 +82,21 @@ MainView {
             }
         }
     }
+    // Lets machines with a pause policy know whether they're on screen
+    function updateShownMachines() {
+        for (var i = 0; i < runningMachineRefs.length; i++) {
+            runningMachineRefs[i].value.shown = selectedMachine !== null &&
+                    runningMachineRefs[i].key === selectedMachine.storage
+        }
+    }
+    onSelectedMachineChanged: updateShownMachines()
+
     function reconnect(machine, vncClient) {
+        // Connects once QEMU has created its sockets, preferring the shared
+        // memory display and falling back to VNC if QEMU doesn't offer it
         const socket = machine.storage + "/vnc.sock";
-        vncClient.connectToServer(socket, "");
+        vncClient.connectWhenReady(socket, "",
+                                   machine.sharedMemoryDisplay ? machine.getDisplaySocket() : "");
     }
 
 
@@ -203,12 +216,15 @@ MainView {
 
                     ListItemLayout {
                         title.text: machine.name
-                        summary.text: machine.arch + ", " + machine.cores + " cores, " + machine.mem + "MB RAM"
+                        summary.text: machine.arch + ", " + machine.cores + " cores, " + machine.mem + "MB RAM" +
+                                      (machine.running && machine.balloonActual > 0 && machine.balloonActual < machine.mem ?
+                                           " (" + machine.balloonActual + "MB / " + machine.balloonTarget + "MB)" : "")
 
                         Icon {
                             id: icon
                             width: units.gu(2)
-                            name: !machine.running ? "" : "media-playback-start"
+                            name: !machine.running ? "" :
+                                  machine.paused ? "media-playback-pause" : "media-playback-start"
                             color: !machine.running ? theme.palette.normal.base : theme.palette.normal.activity
                         }
                     }
@@ -242,20 +258,13 @@ MainView {
                         Qt.inputMethod.show()
                 }
 
-                Timer {
-                    id: delayedReconnect
-                    onTriggered: reconnect(vmDetails.machine, vncClient)
-                    interval: 500
-                    repeat: !vncClient.connected
-                }
-
                 Connections {
                     target: machine
                     onStarted: {
                         starting = false
                         registerMachine(machine)
                         if (!machine.externalWindowOnly)
-                            delayedReconnect.start()
+                            reconnect(machine, vncClient)
                     }
                     onStopped: {
                         starting = false
@@ -278,7 +287,7 @@ MainView {
 
                 Component.onDestruction: {
                     root.fullscreenMode = false
-                    delayedReconnect.stop()
+                    vncClient.disconnect()
                 }
 
                 header: PageHeader {
@@ -289,7 +298,7 @@ MainView {
                             Action {
                                 iconName: "settings"
                                 text: i18n.tr("Settings")
-                                enabled: !machine.running && !starting
+                                enabled: !machine.running && !starting && !machine.suspending
                                 onTriggered: {
                                     mainPage.pageStack.addPageToNextColumn(mainPage,
                                                                            addVmComponent.createObject(mainPage,
@@ -300,18 +309,38 @@ MainView {
                             },
                             Action {
                                 iconName: !machine.running ? "media-playback-start" : "media-playback-stop"
-                                text: !machine.running ? i18n.tr("Start") : i18n.tr("Stop")
-                                enabled: !starting
+                                text: !machine.running ?
+                                          (machine.hasSavedState ? i18n.tr("Resume") : i18n.tr("Start")) :
+                                          machine.shuttingDown ? i18n.tr("Force stop") :
+                                          (machine.suspendOnStop && machine.canSuspend() ? i18n.tr("Suspend") : i18n.tr("Stop"))
+                                enabled: !starting && !machine.suspending
                                 onTriggered: {
                                     if (!machine.running) {
                                         starting = machine.start()
-                                    } else {
+                                    } else if (machine.shuttingDown) {
+                                        machine.forceStop()
+                                    } else if (machine.suspendOnStop && machine.canSuspend()) {
                                         vncClient.disconnect();
                                         machine.stop()
                                         fullscreenMode = false
+                                    } else {
+                                        // Keep showing the guest while it powers off
+                                        machine.stop()
                                     }
                                 }
                             },
+                            Action {
+                                iconName: machine.paused ? "media-playback-start" : "media-playback-pause"
+                                text: machine.paused ? i18n.tr("Continue") : i18n.tr("Pause")
+                                visible: machine.running && machine.controlReady
+                                enabled: !machine.suspending && !machine.shuttingDown
+                                onTriggered: {
+                                    if (machine.paused)
+                                        machine.resume()
+                                    else
+                                        machine.pause()
+                                }
+                            },
                             Action {
                                 iconName: "terminal-app-symbolic"
                                 text: i18n.tr("Serial console")
@@ -330,6 +359,18 @@ MainView {
                                     root.fullscreenMode = !root.fullscreenMode
                                 }
                             },
+                            Action {
+                                iconName: vncClient.pasting ? "media-playback-stop" : "edit-paste"
+                                text: vncClient.pasting ? i18n.tr("Stop pasting") : i18n.tr("Paste")
+                                enabled: vncClient.connected
+                                visible: !machine.externalWindowOnly && machine.running && !serialTerminalEnabled
+                                onTriggered: {
+                                    if (vncClient.pasting)
+                                        vncClient.cancelPaste()
+                                    else
+                                        vncClient.pasteClipboard()
+                                }
+                            },
                             Action {
                                 iconName: "input-keyboard-symbolic"
                                 text: i18n.tr("Keyboard")
@@ -345,8 +386,8 @@ MainView {
                 }
                 VncClient {
                     id: vncClient
-                    onConnectedChanged: {
-                        console.log("Connected: " + vncClient.connected)
+                    onConnectionStateChanged: {
+                        console.log("Connection state: " + vncClient.connectionState)
                     }
                 }
                 Column {
@@ -495,24 +536,70 @@ MainView {
                 }
                 ActivityIndicator {
                     id: startingActivity
-                    running: starting
+                    running: starting || machine.suspending
                     anchors.centerIn: parent
                 }
                 Rectangle {
-                    anchors.fill: viewer
+                    anchors.fill: viewerPinchArea
                     color: "black"
                     visible: viewer.visible
                 }
-                VncOutput {
-                    id: viewer
-                    client: vncClient
+                // Two fingers zoom and pan the view; single touches go to the VM
+                PinchArea {
+                    id: viewerPinchArea
                     anchors {
                         top: vmDetailsHeader.bottom
                         left: parent.left
                         right: parent.right
                         bottom: parent.bottom
                     }
-                    visible: machine.running && !machine.externalWindowOnly
+                    enabled: viewer.visible
+
+                    property real startScale: 1.0
+                    property point startPoint // in VNC coordinates
+                    property point lastCenter
+                    property real lastTime: 0
+                    property point velocity: Qt.point(0, 0) // pixels per second
+
+                    onPinchStarted: {
+                        viewer.beginGesture()
+                        startScale = viewer.scale
+                        startPoint = viewer.itemToVnc(pinch.center)
+                        lastCenter = pinch.center
+                        lastTime = Date.now()
+                        velocity = Qt.point(0, 0)
+                    }
+                    onPinchUpdated: {
+                        viewer.requestedScale = startScale * pinch.scale
+                        // Keep the point between the fingers under them
+                        var point = viewer.itemToVnc(pinch.center)
+                        viewer.center = Qt.point(viewer.center.x + startPoint.x - point.x,
+                                                 viewer.center.y + startPoint.y - point.y)
+
+                        var now = Date.now()
+                        var seconds = (now - lastTime) / 1000
+                        if (seconds > 0) {
+                            // Smoothed, so that a single jittery event doesn't decide the flick
+                            velocity = Qt.point(0.5 * velocity.x + 0.5 * (pinch.center.x - lastCenter.x) / seconds,
+                                                0.5 * velocity.y + 0.5 * (pinch.center.y - lastCenter.y) / seconds)
+                        }
+                        lastCenter = pinch.center
+                        lastTime = now
+                    }
+                    onPinchFinished: {
+                        // Fingers which stopped before being lifted don't flick
+                        if (Date.now() - lastTime > 100) {
+                            velocity = Qt.point(0, 0)
+                        }
+                        viewer.endGesture(velocity)
+                    }
+
+                    VncOutput {
+                        id: viewer
+                        client: vncClient
+                        anchors.fill: parent
+                        visible: machine.running && !machine.externalWindowOnly
+                    }
                 }
                 QMLTermWidget {
                     id: serialConnection
@@ -681,10 +768,22 @@ MainView {
                                                 externalWindowOnlyCheckbox.enabled &&
                                                 externalWindowOnlyCheckbox.checked;
                                         newMachine.useVirglrenderer =
-                                                externalWindowOnlyCheckbox.enabled &&
+                                                virglrendererCheckbox.enabled &&
                                                 virglrendererCheckbox.checked;
                                         newMachine.enableVirtualization =
                                                 virtualizationCheckbox.checked;
+                                        newMachine.sharedMemoryDisplay =
+                                                sharedMemoryDisplayCheckbox.enabled &&
+                                                sharedMemoryDisplayCheckbox.checked;
+                                        newMachine.suspendOnStop =
+                                                suspendOnStopCheckbox.enabled &&
+                                                suspendOnStopCheckbox.checked;
+                                        newMachine.pausePolicy =
+                                                pausePolicySelector.selectedIndex;
+                                        newMachine.autoBalloon =
+                                                autoBalloonCheckbox.checked;
+                                        newMachine.cpuPlacement =
+                                                cpuPlacementSelector.selectedIndex;
 
                                         if (VMManager.createVM(newMachine)) {
                                             VMManager.refreshVMs();
@@ -706,10 +805,21 @@ MainView {
                                                 externalWindowOnlyCheckbox.checked;
                                         existingMachine.useVirglrenderer =
                                                 virglrendererCheckbox.enabled &&
-                                                virglrendererCheckbox.checked &&
-                                                externalWindowOnlyCheckbox.checked;
+                                                virglrendererCheckbox.checked;
                                         existingMachine.enableVirtualization =
                                                 virtualizationCheckbox.checked;
+                                        existingMachine.sharedMemoryDisplay =
+                                                sharedMemoryDisplayCheckbox.enabled &&
+                                                sharedMemoryDisplayCheckbox.checked;
+                                        existingMachine.suspendOnStop =
+                                                suspendOnStopCheckbox.enabled &&
+                                                suspendOnStopCheckbox.checked;
+                                        existingMachine.pausePolicy =
+                                                pausePolicySelector.selectedIndex;
+                                        existingMachine.autoBalloon =
+                                                autoBalloonCheckbox.checked;
+                                        existingMachine.cpuPlacement =
+                                                cpuPlacementSelector.selectedIndex;
 
                                         if (VMManager.editVM(existingMachine)) {
                                             VMManager.refreshVMs();
@@ -866,14 +976,30 @@ MainView {
                             width: parent.width
                             Switch {
                                 id: virglrendererCheckbox
-                                enabled: externalWindowOnlyCheckbox.checked
+                                enabled: externalWindowOnlyCheckbox.checked ||
+                                         sharedMemoryDisplayCheckbox.checked
                                 checked: editMode ? existingMachine.useVirglrenderer : false
                                 anchors.verticalCenter: virglHint.verticalCenter
                             }
                             ListItemLayout {
                                 id: virglHint
                                 title.text: i18n.tr("3D graphics support")
-                                summary.text: i18n.tr("Enables 3D acceleration in windowed mode")
+                                summary.text: i18n.tr("Enables 3D acceleration in windowed mode or with the shared memory display")
+                            }
+                        }
+
+                        Row {
+                            width: parent.width
+                            Switch {
+                                id: sharedMemoryDisplayCheckbox
+                                enabled: !externalWindowOnlyCheckbox.checked
+                                checked: editMode ? existingMachine.sharedMemoryDisplay : false
+                                anchors.verticalCenter: sharedMemoryDisplayHint.verticalCenter
+                            }
+                            ListItemLayout {
+                                id: sharedMemoryDisplayHint
+                                title.text: i18n.tr("Shared memory display")
+                                summary.text: i18n.tr("Shows the VM screen without VNC encoding")
                             }
                         }
 
@@ -890,6 +1016,65 @@ MainView {
                                 summary.text: i18n.tr("Accessible via the virtiofs mount tag 'pocketvms'")
                             }
                         }
+
+                        Row {
+                            width: parent.width
+                            Switch {
+                                id: suspendOnStopCheckbox
+                                // Mirrors Machine::canSuspend()
+                                enabled: !fileSharingCheckbox.checked &&
+                                         !(virglrendererCheckbox.enabled && virglrendererCheckbox.checked)
+                                checked: editMode ? existingMachine.suspendOnStop : false
+                                anchors.verticalCenter: suspendOnStopHint.verticalCenter
+                            }
+                            ListItemLayout {
+                                id: suspendOnStopHint
+                                title.text: i18n.tr("Suspend when stopping")
+                                summary.text: i18n.tr("Resumes where it left off, not available with file sharing or 3D graphics")
+                            }
+                        }
+
+                        Row {
+                            width: parent.width
+                            Switch {
+                                id: autoBalloonCheckbox
+                                checked: editMode ? existingMachine.autoBalloon : true
+                                anchors.verticalCenter: autoBalloonHint.verticalCenter
+                            }
+                            ListItemLayout {
+                                id: autoBalloonHint
+                                title.text: i18n.tr("Reclaim memory when low")
+                                summary.text: i18n.tr("Shrinks the VM memory while the device runs out of it")
+                            }
+                        }
+
+                        // Indices match Machine.CpuPlacement
+                        OptionSelector {
+                            id: cpuPlacementSelector
+                            text: VMManager.efficiencyCores > 0 ?
+                                      i18n.tr("CPU placement (%1 performance, %2 efficiency cores)")
+                                          .arg(VMManager.performanceCores).arg(VMManager.efficiencyCores) :
+                                      i18n.tr("CPU placement")
+                            model: [
+                                i18n.tr("Automatic"),
+                                i18n.tr("Performance cores"),
+                                i18n.tr("Efficiency cores"),
+                                i18n.tr("One core per CPU, fastest first")
+                            ]
+                            selectedIndex: editMode ? existingMachine.cpuPlacement : Machine.PlaceAnywhere
+                        }
+
+                        // Indices match Machine.PausePolicy
+                        OptionSelector {
+                            id: pausePolicySelector
+                            text: i18n.tr("Pause to save battery")
+                            model: [
+                                i18n.tr("Never"),
+                                i18n.tr("When not shown"),
+                                i18n.tr("When the app is in the background")
+                            ]
+                            selectedIndex: editMode ? existingMachine.pausePolicy : Machine.PauseNever
+                        }
                         
                         Row {
                             width: parent.width
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * pvms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "machine.h"
+#include "qmp_client.h"
+
+// Plays the QEMU side of a QMP monitor: greets every client, and records the
+// commands it gets. Only qmp_capabilities is answered on its own, the rest is
+// up to the test.
+class FakeQmpServer: public QObject {
+    Q_OBJECT
+
+public:
+    FakeQmpServer()
+    {
+        QObject::connect(&this->m_server, &QLocalServer::newConnection, this, &FakeQmpServer::onNewConnection);
+    }
+
+    bool listen(const QString& path)
+    {
+        QLocalServer::removeServer(path);
+        return this->m_server.listen(path);
+    }
+
+    void reply(const QJsonObject& command, const QJsonObject& result)
+    {
+        QJsonObject message;
+        message.insert(QStringLiteral("return"), result);
+        message.insert(QStringLiteral("id"), command.value(QStringLiteral("id")));
+        write(message);
+    }
+
+    void replyError(const QJsonObject& command, const QString& description)
+    {
+        QJsonObject error;
+        error.insert(QStringLiteral("class"), QStringLiteral("GenericError"));
+        error.insert(QStringLiteral("desc"), description);
+        QJsonObject message;
+        message.insert(QStringLiteral("error"), error);
+        message.insert(QStringLiteral("id"), command.value(QStringLiteral("id")));
+        write(message);
+    }
+
+    void sendEvent(const QString& name, const QJsonObject& data)
+    {
+        QJsonObject message;
+        message.insert(QStringLiteral("event"), name);
+        message.insert(QStringLiteral("data"), data);
+        write(message);
+    }
+
+    void write(const QJsonObject& message)
+    {
+        if (this->m_client)
+            this->m_client->write(QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n');
+    }
+
+    void dropClient()
+    {
+        if (this->m_client)
+            this->m_client->disconnectFromServer();
+    }
+
+    // The last command with that name, or an empty object
+    QJsonObject command(const QString& name) const
+    {
+        for (int i = this->received.count() - 1; i >= 0; i--) {
+            if (this->received[i].value(QStringLiteral("execute")).toString() == name)
+                return this->received[i];
+        }
+        return QJsonObject();
+    }
+
+    bool negotiate = true;
+    QList<QJsonObject> received;
+
+private:
+    void onNewConnection()
+    {
+        this->m_client = this->m_server.nextPendingConnection();
+        QObject::connect(this->m_client, &QLocalSocket::readyRead, this, &FakeQmpServer::onReadyRead);
+
+        QJsonObject version;
+        version.insert(QStringLiteral("package"), QStringLiteral("fake"));
+        QJsonObject qmp;
+        qmp.insert(QStringLiteral("version"), version);
+        qmp.insert(QStringLiteral("capabilities"), QJsonArray());
+        QJsonObject greeting;
+        greeting.insert(QStringLiteral("QMP"), qmp);
+        write(greeting);
+    }
+
+    void onReadyRead()
+    {
+        this->m_buffer.append(this->m_client->readAll());
+        int newline;
+        while ((newline = this->m_buffer.indexOf('\n')) >= 0) {
+            const QJsonObject command = QJsonDocument::fromJson(this->m_buffer.left(newline)).object();
+            this->m_buffer.remove(0, newline + 1);
+            this->received.append(command);
+
+            // The negotiation is the only command which comes without an id
+            if (this->negotiate && command.value(QStringLiteral("execute")).toString() == QStringLiteral("qmp_capabilities"))
+                write(QJsonObject{{QStringLiteral("return"), QJsonObject()}});
+        }
+    }
+
+    QLocalServer m_server;
+    QLocalSocket* m_client = nullptr;
+    QByteArray m_buffer;
+};
+
+class QmpClientTest: public QObject {
+    Q_OBJECT
+
+private:
+    QString socketPath() const;
+    bool connectClient(QmpClient* client, FakeQmpServer* server);
+
+    QTemporaryDir m_dir;
+
+private Q_SLOTS:
+    void testNegotiation();
+    void testQueuedBeforeReady();
+    void testIdMatching();
+    void testEvents();
+    void testFailPendingOnDisconnect();
+    void testFailPendingWithoutServer();
+    void testPowerdownTimeout();
+};
+
+QString QmpClientTest::socketPath() const
+{
+    return this->m_dir.filePath(QStringLiteral("qmp.sock"));
+}
+
+bool QmpClientTest::connectClient(QmpClient* client, FakeQmpServer* server)
+{
+    if (!server->listen(socketPath()))
+        return false;
+    client->connectToServer(socketPath());
+    return QTest::qWaitFor([client]() { return client->isReady(); }, 5000);
+}
+
+void QmpClientTest::testNegotiation()
+{
+    FakeQmpServer server;
+    server.negotiate = false;
+    QVERIFY(server.listen(socketPath()));
+
+    QmpClient client;
+    QSignalSpy ready(&client, &QmpClient::ready);
+    client.connectToServer(socketPath());
+
+    // The greeting is answered with the capabilities negotiation...
+    QTRY_COMPARE(server.received.count(), 1);
+    const QJsonObject negotiation = server.received.first();
+    QCOMPARE(negotiation.value(QStringLiteral("execute")).toString(), QStringLiteral("qmp_capabilities"));
+    QVERIFY(!negotiation.contains(QStringLiteral("id")));
+    QVERIFY(!client.isReady());
+
+    // ... and the client is only ready once it has been accepted
+    server.write(QJsonObject{{QStringLiteral("return"), QJsonObject()}});
+    QTRY_COMPARE(ready.count(), 1);
+    QVERIFY(client.isReady());
+}
+
+void QmpClientTest::testQueuedBeforeReady()
+{
+    FakeQmpServer server;
+    server.negotiate = false;
+    QVERIFY(server.listen(socketPath()));
+
+    QmpClient client;
+    client.execute(QStringLiteral("query-status"));
+    QJsonObject arguments;
+    arguments.insert(QStringLiteral("value"), 512 * 1024 * 1024);
+    client.execute(QStringLiteral("balloon"), arguments);
+    client.connectToServer(socketPath());
+
+    // Nothing but the negotiation goes out before it's over
+    QTRY_COMPARE(server.received.count(), 1);
+    QTest::qWait(100);
+    QCOMPARE(server.received.count(), 1);
+
+    server.write(QJsonObject{{QStringLiteral("return"), QJsonObject()}});
+    QTRY_COMPARE(server.received.count(), 3);
+    QCOMPARE(server.received[1].value(QStringLiteral("execute")).toString(), QStringLiteral("query-status"));
+    QCOMPARE(server.received[2].value(QStringLiteral("execute")).toString(), QStringLiteral("balloon"));
+    QCOMPARE(server.received[2].value(QStringLiteral("arguments")).toObject(), arguments);
+    QVERIFY(server.received[1].value(QStringLiteral("id")) != server.received[2].value(QStringLiteral("id")));
+}
+
+void QmpClientTest::testIdMatching()
+{
+    FakeQmpServer server;
+    QmpClient client;
+    QVERIFY(connectClient(&client, &server));
+
+    QJsonObject statusReply, cpusReply, stopReply;
+    client.execute(QStringLiteral("query-status"), QJsonObject(), [&](const QJsonObject& reply) {
+        statusReply = reply;
+    });
+    client.execute(QStringLiteral("query-cpus-fast"), QJsonObject(), [&](const QJsonObject& reply) {
+        cpusReply = reply;
+    });
+    client.execute(QStringLiteral("stop"), QJsonObject(), [&](const QJsonObject& reply) {
+        stopReply = reply;
+    });
+    QTRY_COMPARE(server.received.count(), 4);
+
+    // Out of order, with an event in between
+    QJsonObject cpus;
+    cpus.insert(QStringLiteral("cpus"), 4);
+    server.reply(server.command(QStringLiteral("query-cpus-fast")), cpus);
+    server.sendEvent(QStringLiteral("STOP"), QJsonObject());
+    server.replyError(server.command(QStringLiteral("stop")), QStringLiteral("not now"));
+    QJsonObject status;
+    status.insert(QStringLiteral("status"), QStringLiteral("running"));
+    server.reply(server.command(QStringLiteral("query-status")), status);
+
+    QTRY_VERIFY(!statusReply.isEmpty());
+    QCOMPARE(statusReply.value(QStringLiteral("return")).toObject(), status);
+    QCOMPARE(cpusReply.value(QStringLiteral("return")).toObject(), cpus);
+    QCOMPARE(QmpClient::errorString(stopReply), QStringLiteral("not now"));
+}
+
+void QmpClientTest::testEvents()
+{
+    FakeQmpServer server;
+    QmpClient client;
+    QVERIFY(connectClient(&client, &server));
+
+    QSignalSpy events(&client, &QmpClient::event);
+    QJsonObject data;
+    data.insert(QStringLiteral("guest"), true);
+    data.insert(QStringLiteral("reason"), QStringLiteral("guest-shutdown"));
+    server.sendEvent(QStringLiteral("SHUTDOWN"), data);
+
+    QTRY_COMPARE(events.count(), 1);
+    QCOMPARE(events[0][0].toString(), QStringLiteral("SHUTDOWN"));
+    QCOMPARE(events[0][1].value<QJsonObject>(), data);
+}
+
+void QmpClientTest::testFailPendingOnDisconnect()
+{
+    FakeQmpServer server;
+    QmpClient client;
+    QVERIFY(connectClient(&client, &server));
+
+    QSignalSpy disconnected(&client, &QmpClient::disconnected);
+    QJsonObject reply;
+    client.execute(QStringLiteral("system_powerdown"), QJsonObject(), [&](const QJsonObject& r) {
+        reply = r;
+    });
+    QTRY_COMPARE(server.received.count(), 2);
+
+    // QEMU going away answers every command still waiting
+    server.dropClient();
+    QTRY_COMPARE(disconnected.count(), 1);
+    QVERIFY(!client.isReady());
+    QCOMPARE(QmpClient::errorString(reply), QStringLiteral("QMP connection lost"));
+}
+
+void QmpClientTest::testFailPendingWithoutServer()
+{
+    QmpClient client;
+    QJsonObject reply;
+    client.execute(QStringLiteral("query-status"), QJsonObject(), [&](const QJsonObject& r) {
+        reply = r;
+    });
+
+    // Queued commands are answered once the client gives up on the socket
+    client.connectToServer(this->m_dir.filePath(QStringLiteral("missing.sock")), 300);
+    QTRY_VERIFY(!reply.isEmpty());
+    QCOMPARE(QmpClient::errorString(reply), QStringLiteral("QMP connection lost"));
+}
+
+void QmpClientTest::testPowerdownTimeout()
+{
+    // Machine runs bin/qemu-system-<arch> next to the executable; this one
+    // starts fine, and then ignores everything until it's killed
+    const QString binDir = QCoreApplication::applicationDirPath() + QStringLiteral("/bin");
+    const QString qemuBin = binDir + QStringLiteral("/qemu-system-pvmstest");
+    QDir().mkpath(binDir);
+    QFile script(qemuBin);
+    if (!script.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        QSKIP("Cannot write the fake QEMU next to the test");
+    script.write("#!/bin/sh\nexec sleep 60\n");
+    script.close();
+    script.setPermissions(script.permissions() | QFile::ExeOwner);
+
+    QTemporaryDir storage;
+    QVERIFY(storage.isValid());
+    Machine machine;
+    machine.name = QStringLiteral("test");
+    machine.arch = QStringLiteral("pvmstest");
+    machine.cores = 1;
+    machine.mem = 128;
+    machine.storage = storage.path();
+    machine.hdd = storage.filePath(QStringLiteral("disk.qcow2"));
+    machine.shutdownTimeout = 500;
+
+    QVERIFY(machine.start());
+    QTRY_VERIFY(machine.running);
+
+    // The monitor is only looked for once QEMU is started
+    FakeQmpServer server;
+    QVERIFY(server.listen(machine.getControlSocket()));
+    QTRY_VERIFY_WITH_TIMEOUT(machine.isControlReady(), 5000);
+
+    QSignalSpy stopped(&machine, &Machine::stopped);
+    QElapsedTimer timer;
+    timer.start();
+    machine.shutdown();
+    QVERIFY(machine.isShuttingDown());
+    QTRY_VERIFY(!server.command(QStringLiteral("system_powerdown")).isEmpty());
+
+    // The guest never powers off, so QEMU gets killed after the timeout
+    QTRY_VERIFY_WITH_TIMEOUT(stopped.count() > 0, 10000);
+    QVERIFY(timer.elapsed() >= machine.shutdownTimeout);
+    QVERIFY(!machine.running);
+    QTRY_VERIFY_WITH_TIMEOUT(!machine.isShuttingDown(), 5000);
+
+    QFile::remove(qemuBin);
+}
+
+QTEST_MAIN(QmpClientTest)
+
+#include "qmp_client_test.moc"
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scaler.h"
+#include "vnc_downscaler.h"
+#include "vnc_texture.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QPainter>
+#include <QScopedPointer>
+#include <QTest>
+#include <QVector>
+
+using namespace LomiriVNC;
+
+typedef QVector<Scaler::InputData> InputSequence;
+Q_DECLARE_METATYPE(InputSequence)
+
+/* The ways of drawing a 1080p frame at a quarter of its size */
+enum DownscaleMethod {
+    BoxFilter, // VncDownscaler alone
+    BoxFilterAndGpu, // VncDownscaler, then uploading and drawing the result
+    SmoothScaled, // QImage::scaled(Qt::SmoothTransformation)
+    GpuBilinear, // uploading the full frame and sampling it bilinearly
+};
+Q_DECLARE_METATYPE(DownscaleMethod)
+
+class ScalerTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    static Scaler::InputData input(double scale, const QPointF &center);
+    static InputSequence pinch();
+    static InputSequence pan();
+    static void addSequences();
+    static QImage desktop(const QSize &size);
+    bool makeCurrent();
+    void draw(VncTexture *texture);
+
+    QScopedPointer<QOffscreenSurface> m_surface;
+    QScopedPointer<QOpenGLContext> m_context;
+    QScopedPointer<QOpenGLFramebufferObject> m_fbo;
+    QScopedPointer<QOpenGLShaderProgram> m_program;
+
+private Q_SLOTS:
+    void testFitOffset_data();
+    void testFitOffset();
+    void testMinimumScale();
+    void testMapEqualsUpdateMapping_data();
+    void testMapEqualsUpdateMapping();
+    void benchmarkUpdateMapping_data();
+    void benchmarkUpdateMapping();
+    void benchmarkMap_data();
+    void benchmarkMap();
+    void testDownscaleDamage();
+    void benchmarkDownscale_data();
+    void benchmarkDownscale();
+    void cleanupTestCase();
+};
+
+/* During a pinch VncOutput is given the new scale and then the new center,
+ * and maps the input again when one of the others (geometry, frame size)
+ * is touched: most steps see the same input more than once */
+static const int mappingsPerStep = 3;
+
+Scaler::InputData ScalerTest::input(double scale, const QPointF &center)
+{
+    Scaler::InputData in;
+    in.sourceSize = QSizeF(1920, 1080);
+    in.itemSize = QSizeF(1280, 720);
+    in.requestedScale = scale;
+    in.requestedCenter = center;
+    return in;
+}
+
+/* Zooming in from the fitted size to 2x (the maximum VncOutput allows),
+ * towards the top left quarter */
+InputSequence ScalerTest::pinch()
+{
+    InputSequence sequence;
+    for (int i = 0; i <= 120; i++) {
+        const double t = i / 120.0;
+        for (int j = 0; j < mappingsPerStep; j++) {
+            sequence.append(input(0.5 + 1.5 * t,
+                                  QPointF(-480, -270) * t));
+        }
+    }
+    return sequence;
+}
+
+/* Panning across the whole desktop at 2x, past its edges */
+InputSequence ScalerTest::pan()
+{
+    InputSequence sequence;
+    for (int i = 0; i <= 120; i++) {
+        const double t = i / 120.0;
+        for (int j = 0; j < mappingsPerStep; j++) {
+            sequence.append(input(2.0, QPointF(-1200 + 2400 * t,
+                                               300 - 600 * t)));
+        }
+    }
+    return sequence;
+}
+
+void ScalerTest::addSequences()
+{
+    QTest::addColumn<InputSequence>("sequence");
+
+    QTest::newRow("pinch") << pinch();
+    QTest::newRow("pan") << pan();
+}
+
+/* QRectF's operator== is relative, and too strict around 0 */
+static bool sameRect(const QRectF &a, const QRectF &b)
+{
+    return qAbs(a.left() - b.left()) < 1e-6 &&
+        qAbs(a.top() - b.top()) < 1e-6 &&
+        qAbs(a.right() - b.right()) < 1e-6 &&
+        qAbs(a.bottom() - b.bottom()) < 1e-6;
+}
+
+void ScalerTest::testFitOffset_data()
+{
+    QTest::addColumn<QRectF>("view");
+    QTest::addColumn<QSizeF>("objectSize");
+    QTest::addColumn<QPointF>("expectedOffset");
+
+    QTest::newRow("fits exactly") <<
+        QRectF(0, 0, 100, 50) << QSizeF(100, 50) << QPointF(0, 0);
+    QTest::newRow("smaller, centered") <<
+        QRectF(-50, -25, 200, 100) << QSizeF(100, 50) << QPointF(0, 0);
+    QTest::newRow("smaller, off center") <<
+        QRectF(0, 0, 200, 100) << QSizeF(100, 50) << QPointF(-50, -25);
+    QTest::newRow("larger, past the left and top") <<
+        QRectF(-10, -20, 50, 20) << QSizeF(100, 50) << QPointF(10, 20);
+    QTest::newRow("larger, past the right and bottom") <<
+        QRectF(70, 40, 50, 20) << QSizeF(100, 50) << QPointF(-20, -10);
+    QTest::newRow("larger, inside") <<
+        QRectF(10, 10, 50, 20) << QSizeF(100, 50) << QPointF(0, 0);
+}
+
+void ScalerTest::testFitOffset()
+{
+    QFETCH(QRectF, view);
+    QFETCH(QSizeF, objectSize);
+    QFETCH(QPointF, expectedOffset);
+
+    QCOMPARE(Scaler::computeFitOffset(view, objectSize), expectedOffset);
+}
+
+void ScalerTest::testMinimumScale()
+{
+    Scaler::OutputData out;
+
+    QVERIFY(Scaler::updateMapping(input(0.1, QPointF(100, 100)), &out));
+    QCOMPARE(out.scale, 1280.0 / 1920.0);
+    QCOMPARE(out.center, QPointF(0, 0));
+    QVERIFY(sameRect(out.itemPaintedRect, QRectF(0, 0, 1280, 720)));
+    QVERIFY(sameRect(out.sourceVisibleRect, QRectF(0, 0, 1920, 1080)));
+
+    Scaler::InputData empty = input(1.0, QPointF());
+    empty.itemSize = QSizeF();
+    QVERIFY(!Scaler::updateMapping(empty, &out));
+}
+
+void ScalerTest::testMapEqualsUpdateMapping_data()
+{
+    addSequences();
+}
+
+void ScalerTest::testMapEqualsUpdateMapping()
+{
+    QFETCH(InputSequence, sequence);
+
+    Scaler scaler;
+    for (const Scaler::InputData &in: sequence) {
+        Scaler::OutputData memoized, computed;
+        const bool ok = scaler.map(in, &memoized);
+        QCOMPARE(ok, Scaler::updateMapping(in, &computed));
+        if (!ok) continue;
+        QCOMPARE(memoized.sourceVisibleRect, computed.sourceVisibleRect);
+        QCOMPARE(memoized.itemPaintedRect, computed.itemPaintedRect);
+        QCOMPARE(memoized.scale, computed.scale);
+        QCOMPARE(memoized.center, computed.center);
+        QCOMPARE(memoized.itemToSource, computed.itemToSource);
+        QCOMPARE(memoized.sourceToItem, computed.sourceToItem);
+    }
+}
+
+void ScalerTest::benchmarkUpdateMapping_data()
+{
+    addSequences();
+}
+
+void ScalerTest::benchmarkUpdateMapping()
+{
+    QFETCH(InputSequence, sequence);
+
+    Scaler::OutputData out;
+    QBENCHMARK {
+        for (const Scaler::InputData &in: sequence) {
+            Scaler::updateMapping(in, &out);
+        }
+    }
+}
+
+void ScalerTest::benchmarkMap_data()
+{
+    addSequences();
+}
+
+void ScalerTest::benchmarkMap()
+{
+    QFETCH(InputSequence, sequence);
+
+    Scaler::OutputData out;
+    QBENCHMARK {
+        Scaler scaler;
+        for (const Scaler::InputData &in: sequence) {
+            scaler.map(in, &out);
+        }
+    }
+}
+
+/* Something resembling a desktop: flat areas, gradients and text */
+QImage ScalerTest::desktop(const QSize &size)
+{
+    QImage image(size, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, Qt::darkBlue);
+    gradient.setColorAt(1, Qt::darkMagenta);
+    painter.fillRect(image.rect(), gradient);
+    painter.fillRect(QRect(100, 100, 1200, 800), Qt::white);
+    painter.setPen(Qt::black);
+    for (int y = 120; y < 900; y += 16) {
+        painter.drawText(QPoint(110, y), QStringLiteral(
+            "The quick brown fox jumps over the lazy dog 0123456789"));
+    }
+    return image;
+}
+
+void ScalerTest::testDownscaleDamage()
+{
+    const QSize size(1920, 1080);
+    QImage frame = desktop(size);
+
+    VncDownscaler incremental;
+    QRegion damage = frame.rect();
+    incremental.downscale(frame, 4, &damage);
+
+    /* Change some odd-aligned areas, and only report those */
+    const QRegion changed = QRegion(301, 77, 123, 45) +
+        QRegion(1795, 1001, 125, 79) + QRegion(0, 540, 700, 3);
+    QPainter painter(&frame);
+    for (const QRect &r: changed) painter.fillRect(r, Qt::red);
+    painter.end();
+
+    damage = changed;
+    const QImage updated = incremental.downscale(frame, 4, &damage);
+    int damagedPixels = 0;
+    for (const QRect &r: damage) damagedPixels += r.width() * r.height();
+    QVERIFY(damagedPixels > 0);
+    QVERIFY(damagedPixels < 480 * 270 / 10);
+
+    VncDownscaler full;
+    damage = frame.rect();
+    QCOMPARE(updated, full.downscale(frame, 4, &damage));
+    QCOMPARE(updated.size(), QSize(480, 270));
+}
+
+bool ScalerTest::makeCurrent()
+{
+    if (!m_context) {
+        m_context.reset(new QOpenGLContext);
+        m_surface.reset(new QOffscreenSurface);
+        if (!m_context->create()) return false;
+        m_surface->setFormat(m_context->format());
+        m_surface->create();
+        if (!m_context->makeCurrent(m_surface.data())) return false;
+
+        m_fbo.reset(new QOpenGLFramebufferObject(480, 270));
+        m_program.reset(new QOpenGLShaderProgram);
+        m_program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+            "attribute highp vec2 position;\n"
+            "varying highp vec2 coords;\n"
+            "void main() {\n"
+            "    coords = position * 0.5 + 0.5;\n"
+            "    gl_Position = vec4(position, 0.0, 1.0);\n"
+            "}\n");
+        m_program->addShaderFromSourceCode(QOpenGLShader::Fragment,
+            "uniform sampler2D source;\n"
+            "varying highp vec2 coords;\n"
+            "void main() {\n"
+            "    gl_FragColor = texture2D(source, coords);\n"
+            "}\n");
+        m_program->bindAttributeLocation("position", 0);
+        if (!m_program->link()) return false;
+    }
+    return m_context->isValid() &&
+        m_context->makeCurrent(m_surface.data());
+}
+
+/* What the scene graph does with the texture of VncOutput: one quad,
+ * bilinear sampling; waiting for the GPU so that it's part of the timing */
+void ScalerTest::draw(VncTexture *texture)
+{
+    static const GLfloat quad[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+
+    QOpenGLFunctions *f = m_context->functions();
+    m_fbo->bind();
+    f->glViewport(0, 0, m_fbo->width(), m_fbo->height());
+    m_program->bind();
+    texture->setFiltering(QSGTexture::Linear);
+    texture->bind();
+    m_program->enableAttributeArray(0);
+    m_program->setAttributeArray(0, GL_FLOAT, quad, 2);
+    f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    f->glFinish();
+}
+
+void ScalerTest::benchmarkDownscale_data()
+{
+    QTest::addColumn<DownscaleMethod>("method");
+    QTest::addColumn<QRegion>("damage");
+
+    const QRegion fullFrame(0, 0, 1920, 1080);
+    /* A line of text being typed in a terminal */
+    const QRegion textLine(0, 520, 1920, 20);
+    /* A few widgets repainting */
+    QRegion tiles;
+    for (int i = 0; i < 12; i++) {
+        tiles += QRect(37 + i * 150, 61 + i * 80, 96, 64);
+    }
+
+    const struct {
+        DownscaleMethod method;
+        const char *name;
+    } methods[] = {
+        { BoxFilter, "box filter" },
+        { BoxFilterAndGpu, "box filter + GPU" },
+        { SmoothScaled, "QImage::scaled" },
+        { GpuBilinear, "GPU bilinear" },
+    };
+    for (const auto &m: methods) {
+        QTest::addRow("%s, full frame", m.name) << m.method << fullFrame;
+        QTest::addRow("%s, text line", m.name) << m.method << textLine;
+        QTest::addRow("%s, tiles", m.name) << m.method << tiles;
+    }
+}
+
+void ScalerTest::benchmarkDownscale()
+{
+    QFETCH(DownscaleMethod, method);
+    QFETCH(QRegion, damage);
+
+    const qreal scale = 0.25;
+    const QImage frame = desktop(QSize(1920, 1080));
+    const int factor = VncDownscaler::factorForScale(scale);
+    QCOMPARE(factor, 4);
+
+    if (method == BoxFilterAndGpu || method == GpuBilinear) {
+        if (!makeCurrent()) QSKIP("No OpenGL context");
+    }
+
+    /* The texture and the downscaled levels are kept across frames, as in
+     * VncOutput: start from the state after the first frame */
+    VncDownscaler downscaler;
+    QScopedPointer<VncTexture> texture(new VncTexture);
+    QRegion levelDamage = frame.rect();
+    const QImage &reduced = downscaler.downscale(frame, factor, &levelDamage);
+    if (method == BoxFilterAndGpu) {
+        texture->upload(reduced, levelDamage);
+    } else if (method == GpuBilinear) {
+        texture->upload(frame, frame.rect());
+    }
+
+    switch (method) {
+    case BoxFilter:
+        QBENCHMARK {
+            levelDamage = damage;
+            downscaler.downscale(frame, factor, &levelDamage);
+        }
+        break;
+    case BoxFilterAndGpu:
+        QBENCHMARK {
+            levelDamage = damage;
+            texture->upload(downscaler.downscale(frame, factor, &levelDamage),
+                            levelDamage);
+            draw(texture.data());
+        }
+        break;
+    case SmoothScaled:
+        /* QImage::scaled() has no notion of damage: each damaged area is
+         * scaled on its own (which is also slightly wrong at the edges) */
+        QBENCHMARK {
+            for (const QRect &r: damage) {
+                QImage scaled = frame.copy(r).scaled(
+                    qMax(qRound(r.width() * scale), 1),
+                    qMax(qRound(r.height() * scale), 1),
+                    Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+                Q_UNUSED(scaled);
+            }
+        }
+        break;
+    case GpuBilinear:
+        QBENCHMARK {
+            texture->upload(frame, damage);
+            draw(texture.data());
+        }
+        break;
+    }
+
+    /* The texture must go while its context is current */
+    if (m_context) makeCurrent();
+}
+
+void ScalerTest::cleanupTestCase()
+{
+    if (m_context && makeCurrent()) {
+        m_program.reset();
+        m_fbo.reset();
+        m_context->doneCurrent();
+    }
+}
+
+QTEST_MAIN(ScalerTest)
+
+#include "scaler_test.moc"
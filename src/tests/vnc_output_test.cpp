@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_client.h"
+#include "vnc_output.h"
+
+#include <QDataStream>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QQuickWindow>
+#include <QScopedPointer>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace LomiriVNC;
+
+/* The smallest RFB 3.8 server there is: no authentication, and a single
+ * raw FramebufferUpdate right after the initialization. Whatever the client
+ * sends afterwards is ignored. */
+class FakeRfbServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    FakeRfbServer(const QSize &size);
+
+    bool listen(const QString &path);
+
+private:
+    void onNewConnection();
+    void onReadyRead();
+    QByteArray serverInit() const;
+    QByteArray frameBufferUpdate() const;
+
+    QSize m_size;
+    QLocalServer m_server;
+    QLocalSocket *m_client;
+    qint64 m_received;
+};
+
+FakeRfbServer::FakeRfbServer(const QSize &size):
+    m_size(size),
+    m_client(nullptr),
+    m_received(0)
+{
+    QObject::connect(&m_server, &QLocalServer::newConnection,
+                     this, &FakeRfbServer::onNewConnection);
+}
+
+bool FakeRfbServer::listen(const QString &path)
+{
+    QLocalServer::removeServer(path);
+    return m_server.listen(path);
+}
+
+void FakeRfbServer::onNewConnection()
+{
+    m_client = m_server.nextPendingConnection();
+    m_received = 0;
+    QObject::connect(m_client, &QLocalSocket::readyRead,
+                     this, &FakeRfbServer::onReadyRead);
+    m_client->write("RFB 003.008\n");
+}
+
+void FakeRfbServer::onReadyRead()
+{
+    /* The client's part of the handshake has a fixed length: the protocol
+     * version (12 bytes), the security type (1) and ClientInit (1) */
+    const qint64 before = m_received;
+    m_received += m_client->readAll().size();
+    if (before < 12 && m_received >= 12) {
+        m_client->write(QByteArray::fromHex("0101")); // one type, None
+    }
+    if (before < 13 && m_received >= 13) {
+        m_client->write(QByteArray(4, '\0')); // SecurityResult OK
+    }
+    if (before < 14 && m_received >= 14) {
+        m_client->write(serverInit());
+        m_client->write(frameBufferUpdate());
+    }
+}
+
+QByteArray FakeRfbServer::serverInit() const
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << quint16(m_size.width()) << quint16(m_size.height());
+    /* 32 bpp, depth 24, little endian, true colour, 8 bits per channel */
+    out << quint8(32) << quint8(24) << quint8(0) << quint8(1) <<
+        quint16(255) << quint16(255) << quint16(255) <<
+        quint8(16) << quint8(8) << quint8(0) <<
+        quint8(0) << quint8(0) << quint8(0);
+    const QByteArray name("fake");
+    out << quint32(name.size());
+    out.writeRawData(name.constData(), name.size());
+    return message;
+}
+
+QByteArray FakeRfbServer::frameBufferUpdate() const
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << quint8(0) << quint8(0) << quint16(1);
+    out << quint16(0) << quint16(0) <<
+        quint16(m_size.width()) << quint16(m_size.height()) <<
+        qint32(0); // raw
+    const QByteArray pixels(m_size.width() * m_size.height() * 4, '\x80');
+    out.writeRawData(pixels.constData(), pixels.size());
+    return message;
+}
+
+class VncOutputTest: public QObject
+{
+    Q_OBJECT
+
+private:
+    VncOutput *m_output;
+    QScopedPointer<QQuickWindow> m_window;
+    QScopedPointer<VncClient> m_client;
+    QScopedPointer<FakeRfbServer> m_server;
+    QTemporaryDir m_dir;
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void testCenterChanged();
+    void testMarginsChangedOnResize();
+};
+
+static const QSize frameSize(160, 120);
+
+void VncOutputTest::initTestCase()
+{
+    /* Frames only need to be latched, not drawn */
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+}
+
+void VncOutputTest::init()
+{
+    const QString path = m_dir.filePath("vnc.sock");
+    m_server.reset(new FakeRfbServer(frameSize));
+    QVERIFY(m_server->listen(path));
+
+    m_window.reset(new QQuickWindow);
+    m_window->resize(frameSize);
+    m_output = new VncOutput(m_window->contentItem());
+    m_output->setSize(frameSize);
+    m_client.reset(new VncClient);
+    m_output->setClient(m_client.data());
+    m_window->show();
+
+    m_client->connectToServer(path, QString());
+    QTRY_COMPARE(m_output->remoteScreenSize(), QSizeF(frameSize));
+}
+
+void VncOutputTest::cleanup()
+{
+    m_client->disconnect();
+    m_output->setClient(nullptr);
+    m_window.reset();
+    m_client.reset();
+    m_server.reset();
+}
+
+void VncOutputTest::testCenterChanged()
+{
+    /* At 2x only a quarter of the frame is visible, so the center (an
+     * offset from the middle of the frame) can move within ±40 x ±30 */
+    m_output->setRequestedScale(2.0);
+    QCOMPARE(m_output->scale(), 2.0);
+    QCOMPARE(m_output->center(), QPointF(0, 0));
+
+    QSignalSpy centerChanged(m_output, &VncOutput::centerChanged);
+    m_output->setCenter(QPointF(10, 5));
+    QCOMPARE(centerChanged.count(), 1);
+    QCOMPARE(m_output->center(), QPointF(10, 5));
+
+    /* Clamped, but still a change */
+    m_output->setCenter(QPointF(-100, -100));
+    QCOMPARE(centerChanged.count(), 2);
+    QCOMPARE(m_output->center(), QPointF(-40, -30));
+
+    /* Clamped to where it already is: nothing to notify */
+    m_output->setCenter(QPointF(-50, -50));
+    QCOMPARE(centerChanged.count(), 2);
+}
+
+void VncOutputTest::testMarginsChangedOnResize()
+{
+    QSignalSpy marginsChanged(m_output, &VncOutput::marginsChanged);
+
+    /* Fitted, the frame now leaves margins on the sides */
+    m_output->setSize(QSizeF(320, 120));
+    QCOMPARE(marginsChanged.count(), 1);
+    QVERIFY(m_output->leftMargin() > 0);
+
+    /* Moving the item doesn't change what's painted in it */
+    m_output->setPosition(QPointF(10, 10));
+    QCOMPARE(marginsChanged.count(), 1);
+}
+
+QTEST_MAIN(VncOutputTest)
+
+#include "vnc_output_test.moc"
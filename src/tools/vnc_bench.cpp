@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2026  Alfred Neumayer
+ *
+ * This file is part of LomiriVNC.
+ *
+ * LomiriVNC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LomiriVNC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LomiriVNC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vnc_client.h"
+#include "vnc_output.h"
+#include "vnc_relay.h"
+#include "vnc_stats.h"
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QQuickWindow>
+#include <QTextStream>
+#include <QTimer>
+
+using namespace LomiriVNC;
+
+/* Records sessions from a VNC server (such as the vnc.sock of a running
+ * machine), and replays them through VncClient into a VncOutput shown in an
+ * offscreen window: that is the whole pipeline of the app, minus the server,
+ * so that changes to it can be measured on the same input.
+ *
+ *   pvms-vnc-bench record [-e encodings] [-d depth] [-t seconds] vnc.sock out.rfb
+ *   pvms-vnc-bench replay [--real-time] a.rfb b.rfb...
+ */
+
+namespace {
+
+struct Result {
+    Result(): seconds(0), frames(0), droppedFrames(0), fileSize(0),
+        decode(), paint(), latency() {}
+
+    QString fileName;
+    VncRelay::Header header;
+    QSize resolution;
+    qreal seconds;
+    quint64 frames;
+    quint64 droppedFrames;
+    qint64 fileSize;
+    qreal decode[2]; // average and p95, in ms
+    qreal paint[2];
+    qreal latency[2];
+};
+
+class Viewer
+{
+public:
+    Viewer(VncClient *client, const QSize &size)
+    {
+        m_window.resize(size);
+        VncOutput *output = new VncOutput(m_window.contentItem());
+        output->setSize(size);
+        output->setClient(client);
+        m_window.show();
+    }
+
+private:
+    QQuickWindow m_window;
+};
+
+/* Runs the event loop until the client disconnects (or until `seconds`
+ * have passed, if positive, in which case it's disconnected) */
+void runSession(VncClient *client, int seconds, QSize *resolution)
+{
+    QEventLoop loop;
+    QObject::connect(client, &VncClient::connectionStateChanged, &loop,
+                     [client, &loop]() {
+        if (client->connectionState() == VncClient::Disconnected) {
+            loop.quit();
+        }
+    });
+    QObject::connect(client, &VncClient::frameBufferUpdated, &loop,
+                     [client, resolution]() {
+        *resolution = client->frameSize();
+    });
+    if (seconds > 0) {
+        QTimer::singleShot(seconds * 1000, &loop, [client]() {
+            client->disconnect();
+        });
+    }
+    if (client->connectionState() == VncClient::Disconnected) return;
+    loop.exec();
+}
+
+void collectStats(const VncStats *stats, Result *result)
+{
+    result->frames = stats->frames();
+    result->droppedFrames = stats->droppedFrames();
+    result->decode[0] = stats->average(VncStats::DecodeTime);
+    result->decode[1] = stats->percentile(VncStats::DecodeTime, 95);
+    result->paint[0] = stats->average(VncStats::PaintTime);
+    result->paint[1] = stats->percentile(VncStats::PaintTime, 95);
+    result->latency[0] = stats->average(VncStats::Latency);
+    result->latency[1] = stats->percentile(VncStats::Latency, 95);
+}
+
+void printResult(QTextStream &out, const Result &r)
+{
+    const qreal seconds = qMax(r.seconds, 0.001);
+    out << r.fileName << ": " <<
+        r.resolution.width() << "x" << r.resolution.height() << ", " <<
+        r.header.pixelDepth << " bpp, encodings \"" <<
+        (r.header.encodings.isEmpty() ?
+         QByteArray("default") : r.header.encodings) << "\"\n";
+    out << QString::asprintf("  %.2f s, %.2f MB/s, %llu frames "
+                             "(%.1f/s, %llu dropped)\n",
+                             seconds, r.fileSize / seconds / 1000000,
+                             r.frames, r.frames / seconds, r.droppedFrames);
+    out << QString::asprintf("  decode %.2f ms (p95 %.2f), "
+                             "paint %.2f ms (p95 %.2f), "
+                             "latency %.2f ms (p95 %.2f)\n",
+                             r.decode[0], r.decode[1],
+                             r.paint[0], r.paint[1],
+                             r.latency[0], r.latency[1]);
+}
+
+int record(const QCommandLineParser &parser, const QSize &size)
+{
+    const QStringList args = parser.positionalArguments();
+    if (args.count() != 3) {
+        qWarning() << "Usage: record [options] <server socket> <file>";
+        return EXIT_FAILURE;
+    }
+
+    VncClient client;
+    client.setEncodings(parser.value("encodings"));
+    client.setPixelDepth(parser.value("depth").toInt());
+    client.setRecordFile(args[2]);
+    Viewer viewer(&client, size);
+
+    Result result;
+    result.fileName = args[2];
+    QElapsedTimer timer;
+    timer.start();
+    bool connected = false;
+    QObject::connect(&client, &VncClient::connectionStatusChanged,
+                     [&client, &connected]() {
+        if (client.isConnected()) connected = true;
+    });
+    client.connectToServer(args[1], parser.value("password"));
+    runSession(&client, parser.value("time").toInt(), &result.resolution);
+    result.seconds = timer.elapsed() / 1000.0;
+    if (!connected) {
+        qWarning() << "Could not connect to" << args[1];
+        return EXIT_FAILURE;
+    }
+
+    VncRelay::readHeader(args[2], &result.header);
+    result.fileSize = QFileInfo(args[2]).size();
+    collectStats(client.stats(), &result);
+
+    QTextStream out(stdout);
+    printResult(out, result);
+    return EXIT_SUCCESS;
+}
+
+int replay(const QCommandLineParser &parser, const QSize &size)
+{
+    const QStringList args = parser.positionalArguments();
+    if (args.count() < 2) {
+        qWarning() << "Usage: replay [options] <file>...";
+        return EXIT_FAILURE;
+    }
+
+    VncClient client;
+    Viewer viewer(&client, size);
+    QTextStream out(stdout);
+    int status = EXIT_SUCCESS;
+
+    for (int i = 1; i < args.count(); i++) {
+        Result result;
+        result.fileName = args[i];
+        if (!VncRelay::readHeader(args[i], &result.header)) {
+            qWarning() << "Not a recording:" << args[i];
+            status = EXIT_FAILURE;
+            continue;
+        }
+        result.fileSize = QFileInfo(args[i]).size();
+
+        QElapsedTimer timer;
+        timer.start();
+        if (!client.replay(args[i], parser.isSet("real-time"))) {
+            qWarning() << "Could not replay" << args[i];
+            status = EXIT_FAILURE;
+            continue;
+        }
+        runSession(&client, 0, &result.resolution);
+        result.seconds = timer.elapsed() / 1000.0;
+
+        collectStats(client.stats(), &result);
+        printResult(out, result);
+        out.flush();
+    }
+    return status;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    /* The output is rendered, but nobody needs to see it */
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    app.setApplicationName("pvms-vnc-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Records VNC sessions, and replays them through the viewer");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "record or replay");
+    parser.addOptions({
+        { { "e", "encodings" }, "Encodings to request when recording",
+          "encodings" },
+        { { "d", "depth" }, "Pixel depth when recording (16 or 32)",
+          "depth", "32" },
+        { { "t", "time" }, "Seconds to record for (0 for as long as the "
+          "server is there)", "seconds", "30" },
+        { { "p", "password" }, "Password of the server", "password" },
+        { "real-time", "Replay with the recorded timing instead of as fast "
+          "as possible" },
+        { { "s", "size" }, "Size of the viewer", "WxH", "1280x720" },
+    });
+    parser.process(app);
+
+    const QStringList sizeParts = parser.value("size").split('x');
+    const QSize size(sizeParts.value(0).toInt(), sizeParts.value(1).toInt());
+    if (size.isEmpty()) {
+        qWarning() << "Invalid size" << parser.value("size");
+        return EXIT_FAILURE;
+    }
+
+    const QString command = parser.positionalArguments().value(0);
+    if (command == "record") {
+        return record(parser, size);
+    } else if (command == "replay") {
+        return replay(parser, size);
+    }
+    parser.showHelp(EXIT_FAILURE);
+}